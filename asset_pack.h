@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+
+// Asset pack: one file with every resource, used in place (mmap or embedded)
+// without copying or parsing.
+//
+//   AssetPackHeader
+//   AssetPackEntry[number_of_entries]   sorted by name for binary search
+//   data of every entry, each one aligned to ASSET_PACK_ALIGNMENT and
+//   followed by a 0 byte so text assets can be used as C strings
+//
+// Everything is little endian. hash is the 64 bit FNV-1a of the entry data.
+#define ASSET_PACK_MAGIC     0x4B415053 // "SPAK"
+#define ASSET_PACK_VERSION   1
+#define ASSET_PACK_ALIGNMENT 16
+#define ASSET_NAME_LENGTH    48
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t number_of_entries;
+    uint32_t reserved;
+    uint64_t size; // of the whole pack
+} AssetPackHeader;
+
+typedef struct {
+    char name[ASSET_NAME_LENGTH]; // path relative to resources/, zero padded
+    uint64_t offset;              // from the start of the pack
+    uint64_t size;
+    uint64_t hash;
+} AssetPackEntry;
@@ -0,0 +1,67 @@
+# Turns every file under RESOURCE_DIR into a byte array so the game does not
+# have to read anything from disk at startup.
+#   cmake -DRESOURCE_DIR=<dir> -DOUTPUT_DIR=<dir> -P embed_resources.cmake
+# writes OUTPUT_DIR/embedded_resources.h and OUTPUT_DIR/embedded_resources.c.
+# Every array gets a trailing 0 byte that is not counted in its size, so text
+# resources can be used as C strings, and is aligned like an asset pack entry
+# so a pack can be used in place.
+
+file(GLOB_RECURSE files RELATIVE ${RESOURCE_DIR} ${RESOURCE_DIR}/*)
+list(SORT files)
+
+set(header "// generated by cmake/embed_resources.cmake, do not edit
+#pragma once
+#include <stddef.h>
+
+typedef struct {
+    const char *name;
+    const unsigned char *data;
+    size_t size;
+} EmbeddedResource;
+
+extern const EmbeddedResource EMBEDDED_RESOURCES[];
+extern const size_t NUMBER_OF_EMBEDDED_RESOURCES;
+")
+
+set(source "// generated by cmake/embed_resources.cmake, do not edit
+#include \"embedded_resources.h\"
+")
+set(entries "")
+list(LENGTH files number_of_files)
+
+# cmake regular expressions have no {n}, spell out a line of 16 bytes
+set(line_of_bytes "")
+foreach(i RANGE 15)
+    string(APPEND line_of_bytes "0x..,")
+endforeach()
+
+foreach(name ${files})
+    file(READ ${RESOURCE_DIR}/${name} hex HEX)
+    string(LENGTH "${hex}" hex_length)
+    math(EXPR size "${hex_length} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    string(REGEX REPLACE "(${line_of_bytes})" "\\1\n    " bytes "${bytes}")
+    string(MAKE_C_IDENTIFIER "${name}" id)
+    string(APPEND source "\nstatic _Alignas(16) const unsigned char resource_${id}[] = {\n    ${bytes}0x00\n};\n")
+    string(APPEND entries "    { \"${name}\", resource_${id}, ${size} },\n")
+endforeach()
+
+if(number_of_files EQUAL 0)
+    string(APPEND entries "    { 0 },\n")
+endif()
+string(APPEND source "\nconst EmbeddedResource EMBEDDED_RESOURCES[] = {\n${entries}};\n")
+string(APPEND source "\nconst size_t NUMBER_OF_EMBEDDED_RESOURCES = ${number_of_files};\n")
+
+# only touch the outputs when they change so nothing rebuilds for no reason
+function(write_if_changed path content)
+    set(old "")
+    if(EXISTS ${path})
+        file(READ ${path} old)
+    endif()
+    if(NOT old STREQUAL content)
+        file(WRITE ${path} "${content}")
+    endif()
+endfunction()
+
+write_if_changed(${OUTPUT_DIR}/embedded_resources.h "${header}")
+write_if_changed(${OUTPUT_DIR}/embedded_resources.c "${source}")
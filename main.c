@@ -1,557 +1,5630 @@
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <glad/glad.h>
-#include <glfw/glfw3.h>
+#include <GLFW/glfw3.h>
+
+// stb_image and stb_image_write allocate through the tracking allocator too, see Memory
+void *image_malloc(size_t size);
+void *image_realloc(void *pointer, size_t size);
+void image_free(void *pointer);
+#define STBI_MALLOC(size)           image_malloc(size)
+#define STBI_REALLOC(pointer, size) image_realloc(pointer, size)
+#define STBI_FREE(pointer)          image_free(pointer)
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
-inline void pixels_clear(uint32_t *pixels, size_t size, uint32_t color)
+#define STBIW_MALLOC(size)           image_malloc(size)
+#define STBIW_REALLOC(pointer, size) image_realloc(pointer, size)
+#define STBIW_FREE(pointer)          image_free(pointer)
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include "asset_pack.h"
+#include "embedded_resources.h"
+
+static inline void pixels_clear(uint32_t *pixels, size_t size, uint32_t color)
 {
     for (size_t i = 0; i < size; i++)
         pixels[i] = color;
 }
 
-//==========Window==========//
-#define WINDOW_WIDTH  512
-#define WINDOW_HEIGHT 256
-#define WINDOW_TITLE  "space invaders"
+//==========Clock==========//
+static inline int64_t now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
 
-void init_glfw()
+// set first thing in main, startup steps are reported relative to it
+static int64_t STARTUP_TIME;
+
+static inline double ms_since_startup()
 {
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    printf("INFO : GLFW initialize!\n");
+    return (now_ns() - STARTUP_TIME) / 1e6;
 }
 
-GLFWwindow *create_window()
+// The simulation reads the time only from the frame clock, which samples the
+// monotonic clock once per tick. Game time moves by a fixed step every tick
+// that is simulated, so it is the same on every run, and stands still while
+// paused. The time scale changes how many ticks run per real second, which
+// also slows down or speeds up the movement that is counted per tick.
+#define SIMULATION_RATE 1000 // ticks per second of game time
+#define TIME_SCALE_MIN  0.125
+#define TIME_SCALE_MAX  8.0
+
+typedef struct {
+    int64_t real_time;  // ns, monotonic, when the current tick started
+    int64_t real_delta; // ns since the previous tick started
+    int64_t game_time;  // ns of simulated time at the current tick
+    int64_t game_delta; // ns the current tick simulates, 0 while paused
+    int64_t step;       // ns of game time per tick
+    double scale;
+    bool paused;
+} FrameClock;
+
+static FrameClock CLOCK;
+
+void init_frame_clock(FrameClock *clock, int64_t step, double scale)
 {
-    GLFWwindow *window;
-    GLFWmonitor **monitors = { 0 };
-    int count_monitors     = 0;
-    bool full_screen       = false;
-    if (full_screen) {
-        monitors = glfwGetMonitors(&count_monitors);
-        if (!monitors) {
-            fprintf(stderr, "ERROR: Could not found any monitor!\n");
-            return NULL;
-        }
-        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, monitors[0], NULL);
-    } else {
-        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-    }
-    if (!window) {
-        fprintf(stderr, "ERROR: Could not create window!\n");
-        return NULL;
-    }
-    printf("INFO : GLFW window has been created!\n");
-    glfwMakeContextCurrent(window);
-    return window;
+    *clock = (FrameClock){ .real_time = now_ns(), .step = step, .scale = 1 };
+    if (scale > 0)
+        clock->scale = fmin(fmax(scale, TIME_SCALE_MIN), TIME_SCALE_MAX);
 }
 
-void frame_buffer_callback(GLFWwindow *window, int width, int height)
+void frame_clock_tick(FrameClock *clock)
 {
-    glViewport(0, 0, width, height);
+    int64_t now       = now_ns();
+    clock->real_delta = now - clock->real_time;
+    clock->real_time  = now;
+    clock->game_delta = clock->paused ? 0 : clock->step;
+    clock->game_time += clock->game_delta;
 }
 
-//==========Shader==========//
-char *read_entire_file(const char *filename)
+// real ns between two ticks
+static inline int64_t frame_clock_interval(const FrameClock *clock)
 {
-    FILE *file;
-    fopen_s(&file, filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "ERROR: Could not open file %s\n", filename);
-        return "";
-    }
-    fseek(file, 0, SEEK_END);
-    long length = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    return (int64_t)(clock->step / clock->scale);
+}
 
-    char *buffer = malloc(sizeof(char) * (length + 1));
-    memset(buffer, 0, sizeof(char) * (length + 1));
-    if (buffer == NULL) {
-        fprintf(stderr, "ERROR: Could not malloc memory for reading a file. Please buy more RAM!");
-        return NULL;
-    }
-    size_t actual_size = fread(buffer, sizeof(char), length, file);
-    fclose(file);
+// ticks of game time so far, the simulation counts time in these
+static inline uint64_t game_ticks(const FrameClock *clock)
+{
+    return clock->game_time / clock->step;
+}
 
-    return buffer;
+static inline uint64_t seconds_to_ticks(double seconds)
+{
+    return (uint64_t)llround(seconds * SIMULATION_RATE);
 }
 
-unsigned int compile_shader(const char *vertex_filename, const char *fragment_filename)
+void set_time_scale(FrameClock *clock, double scale)
 {
-    int success;
-    char msg[512];
-    // vertex shader
-    unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    char *vertex_shader_source = read_entire_file(vertex_filename);
-    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
-    glCompileShader(vertex_shader);
-    // check for shader compile errors
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertex_shader, 512, NULL, msg);
-        fprintf(stderr, "ERROR: Vertex shader compilation failed: %s\n", msg);
-    }
-    // fragment shader
-    unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-    char *fragment_shader_source = read_entire_file(fragment_filename);
-    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
-    glCompileShader(fragment_shader);
-    // check for shader compile errors
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragment_shader, 512, NULL, msg);
-        fprintf(stderr, "ERROR: Fragment shader compilation failed: %s\n", msg);
-    }
-    // link shaders
-    unsigned int shader_program = glCreateProgram();
-    glAttachShader(shader_program, vertex_shader);
-    glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program);
-    // check for linking errors
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shader_program, 512, NULL, msg);
-        fprintf(stderr, "ERROR: Shader linking failed: %s\n", msg);
-    }
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+    clock->scale = fmin(fmax(scale, TIME_SCALE_MIN), TIME_SCALE_MAX);
+    printf("INFO : Time scale %.3gx\n", clock->scale);
+}
 
-    printf("INFO : Shader compilation is done!\n");
-    return shader_program;
+void set_paused(FrameClock *clock, bool paused)
+{
+    clock->paused = paused;
+    printf("INFO : %s\n", paused ? "Paused" : "Resumed");
 }
 
-//==========Sprite==========//
-typedef struct {
-    uint8_t *data;
-    uint32_t width, height;
-    size_t x;
-    size_t y;
-} Sprite;
+//==========Fixed Point==========//
+// Positions and speeds are 16.16 fixed point, so the simulation does the same
+// integer math on every compiler and CPU and replays or lockstep play stay in
+// sync. Angles are fractions of a turn in 32 bits and wrap by themselves.
+// The sine table is built with integer math only, libm sin may differ in the
+// last bit between machines.
+typedef int32_t Fixed;
+typedef uint32_t Angle;
 
-Sprite *create_new_sprite(uint32_t width, uint32_t height)
+#define FIXED_SHIFT    16
+#define FIXED_ONE      (1 << FIXED_SHIFT)
+#define FIXED(x)       ((Fixed)((x) * FIXED_ONE + ((x) < 0 ? -0.5 : 0.5))) // constants only
+#define ANGLE_TURN     4294967296.0 // constants only
+#define SIN_TABLE_BITS 10
+#define SIN_TABLE_SIZE (1 << SIN_TABLE_BITS)
+#define HALF_PI_2_30   1686629713 // pi / 2 in 2.30 fixed point
+
+static inline Fixed int_to_fixed(int32_t i)
 {
-    uint8_t *data = (uint8_t *)malloc(width * height * sizeof(uint8_t));
-    if (data == NULL) {
-        fprintf(stderr, "Error: Cannot malloc memmory for sprite. Please buy more RAM!\n");
-        return NULL;
-    }
-    Sprite *sprite = malloc(sizeof(Sprite));
-    *sprite        = (Sprite){ data, width, height };
-    return sprite;
+    return i * FIXED_ONE;
 }
 
-void free_sprite(Sprite *sprite)
+// rounds down
+static inline int32_t fixed_to_int(Fixed f)
 {
-    free(sprite->data);
-    sprite->data = NULL;
+    return f >> FIXED_SHIFT;
 }
 
-//==========Animation==========//
-typedef struct
+static inline float fixed_to_float(Fixed f)
 {
-    bool loop;
-    Sprite **frames;
-    size_t number_of_frames;
-    double frame_duration;
-    double start_time; // start animation
-    double time;       // time spent in animation playing from frame 0
-} Anim;
+    return f / (float)FIXED_ONE;
+}
 
-//==========Object==========//
-typedef struct {
-    Sprite *curr_sprite;
-    long double x, y;
-    size_t init_x, init_y;
-    uint32_t color;
-    Anim **animations;
-    size_t number_of_animations;
-} Object;
+static inline Fixed fixed_mul(Fixed a, Fixed b)
+{
+    return (Fixed)(((int64_t)a * b) >> FIXED_SHIFT);
+}
 
-#define pixels(col, row) pixels[((col) * (WINDOW_WIDTH)) + (row)]
+// one more entry so that interpolating the last one does not have to wrap
+static Fixed SIN_TABLE[SIN_TABLE_SIZE + 1];
 
-void draw_object(uint32_t *pixels, Object *obj)
+// Taylor series up to x^11 for x in [0, pi/2], x and the result in 2.30
+static int64_t quarter_sine(int64_t x)
 {
-    const size_t left_up_x = obj->x - (obj->curr_sprite->width / 2);
-    const size_t left_up_y = obj->y - (obj->curr_sprite->height / 2);
-    for (size_t ys = 0; ys < obj->curr_sprite->height; ys++) {
-        for (size_t xs = 0; xs < obj->curr_sprite->width; xs++) {
-            size_t col = (ys + left_up_y);
-            size_t row = xs + left_up_x;
-            if ((col < WINDOW_HEIGHT) & (row < WINDOW_WIDTH) & (obj->curr_sprite->data[xs + ((obj->curr_sprite->height - ys - 1) * (obj->curr_sprite->width))]))
-                pixels(col, row) = obj->color;
-        }
-    }
+    const int64_t one = (int64_t)1 << 30;
+    int64_t x2        = (x * x) >> 30;
+    int64_t sum       = one;
+    for (int64_t n = 11; n >= 3; n -= 2)
+        sum = one - ((x2 * sum) >> 30) / (n * (n - 1));
+    return (x * sum) >> 30;
 }
 
-void delete_object(Object *obj)
+void init_sin_table()
 {
-    free(obj->curr_sprite);
-    free(obj);
+    const size_t quarter = SIN_TABLE_SIZE / 4;
+    for (size_t i = 0; i <= SIN_TABLE_SIZE; i++) {
+        size_t part   = (i / quarter) % 4;
+        size_t offset = part % 2 ? quarter - i % quarter : i % quarter;
+        int64_t sine  = quarter_sine(HALF_PI_2_30 * (int64_t)offset / (int64_t)quarter);
+        Fixed value   = (Fixed)((sine + (1 << 13)) >> 14);
+        SIN_TABLE[i]  = part >= 2 ? -value : value;
+    }
 }
 
-bool check_collision(Object *obj, Object **fires, size_t number_of_fires)
+// linear interpolation between the table entries
+static inline Fixed fixed_sin(Angle angle)
 {
-    size_t up_obj    = obj->y + (obj->curr_sprite->height / 2);
-    size_t down_obj  = obj->y - (obj->curr_sprite->height / 2);
-    size_t right_obj = obj->x + (obj->curr_sprite->width / 2);
-    size_t left_obj  = obj->x - (obj->curr_sprite->width / 2);
-    for (size_t i = 0; i < number_of_fires; i++) {
-        if (fires[i] == NULL)
-            continue;
-        size_t up_fire    = fires[i]->y + (fires[i]->curr_sprite->height / 2);
-        size_t down_fire  = fires[i]->y - (fires[i]->curr_sprite->height / 2);
-        size_t left_fire  = fires[i]->x - (fires[i]->curr_sprite->width / 2);
-        size_t right_fire = fires[i]->x + (fires[i]->curr_sprite->width / 2);
-
-        // TODO: also check curr_sprite data
-        if (((up_fire < up_obj && up_fire > down_obj) || (down_fire < up_obj && down_fire > down_obj)) && ((left_fire > right_obj && left_fire < left_obj) || (right_fire < right_obj && right_fire > left_obj))) {
-            delete_object(fires[i]);
-            fires[i] = NULL;
-            return true;
-        }
-    }
-    return false;
+    uint32_t index    = angle >> (32 - SIN_TABLE_BITS);
+    uint32_t fraction = angle & ((1u << (32 - SIN_TABLE_BITS)) - 1);
+    Fixed low         = SIN_TABLE[index];
+    return low + (Fixed)(((int64_t)(SIN_TABLE[index + 1] - low) * fraction) >> (32 - SIN_TABLE_BITS));
 }
 
-void play_object_animation(Object *obj, Anim *anim)
+static inline Fixed fixed_cos(Angle angle)
 {
-    if ((anim->number_of_frames * anim->frame_duration) < anim->time) {
-        if (!anim->loop)
-            return;
-        else if (anim->loop) {
-            anim->time       = 0.0;
-            anim->start_time = glfwGetTime();
-        }
-    }
-    size_t index     = (size_t)(anim->time / anim->frame_duration);
-    obj->curr_sprite = anim->frames[index];
-    anim->time       = (glfwGetTime() - anim->start_time);
+    return fixed_sin(angle + (1u << 30));
 }
 
-//==========Player==========//
-#define PLAYER_SPRITE_WIDTH  11
-#define PLAYER_SPRITE_HEIGHT 7
-
-const static uint8_t player_sprite_data[] = {
-    0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, // .....@.....
-    0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, // ....@@@....
-    0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, // ....@@@....
-    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, // .@@@@@@@@@.
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@@@@
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@@@@
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@@@@
+//==========Memory==========//
+// Every allocation of the game goes through memory_alloc() and friends with
+// the subsystem it belongs to. Without --track-memory they are plain malloc
+// and free. With it every block carries a header with its tag and call site,
+// the live blocks are kept in a list and on exit we print how much each
+// subsystem used and every block that was never freed.
+// Tracking is switched on before the first allocation and never off again,
+// a block has a header exactly when tracking is on.
+#define MEMORY_MAX_LEAK_SITES 64
+
+typedef enum {
+    MEMORY_ASSETS,      // resources, caches and decoded images
+    MEMORY_SPRITES,
+    MEMORY_ENEMIES,
+    MEMORY_FRAMEBUFFER,
+    MEMORY_JOBS,
+    MEMORY_ARENAS,
+    MEMORY_REWIND,
+    MEMORY_NETPLAY,
+    MEMORY_SPECTATOR,
+    MEMORY_CAPTURE,
+    NUMBER_OF_MEMORY_TAGS,
+} MemoryTag;
+
+static const char *MEMORY_TAG_NAMES[NUMBER_OF_MEMORY_TAGS] = { "assets", "sprites", "enemies", "framebuffer", "jobs", "arenas", "rewind", "netplay", "spectator", "capture" };
+
+typedef struct Allocation Allocation;
+struct Allocation {
+    Allocation *next, *prev;
+    const char *file;
+    int line;
+    MemoryTag tag;
+    size_t size;
 };
 
-static Object PLAYER_OBJECT;
+// keeps the blocks as aligned as malloc would
+#define ALLOCATION_HEADER_SIZE ((sizeof(Allocation) + 15) & ~(size_t)15)
+
+typedef struct {
+    size_t live;
+    size_t peak;
+    size_t allocations;
+    size_t frees;
+} MemoryStats;
+
+static struct {
+    bool tracking;
+    pthread_mutex_t mutex; // guards everything below, blocks come and go on several threads
+    Allocation *blocks;
+    MemoryStats stats[NUMBER_OF_MEMORY_TAGS];
+} MEMORY = { .mutex = PTHREAD_MUTEX_INITIALIZER };
 
-void init_player_object()
+#define memory_alloc(tag, size)            tracked_malloc(tag, size, __FILE__, __LINE__)
+#define memory_calloc(tag, count, size)    tracked_calloc(tag, count, size, __FILE__, __LINE__)
+#define memory_realloc(tag, pointer, size) tracked_realloc(tag, pointer, size, __FILE__, __LINE__)
+#define memory_free(pointer)               tracked_free(pointer)
+
+void start_memory_tracking()
 {
-    PLAYER_OBJECT.curr_sprite       = create_new_sprite(PLAYER_SPRITE_WIDTH, PLAYER_SPRITE_HEIGHT);
-    PLAYER_OBJECT.curr_sprite->data = player_sprite_data;
-    PLAYER_OBJECT.x = PLAYER_OBJECT.init_x = WINDOW_WIDTH / 2;
-    PLAYER_OBJECT.y = PLAYER_OBJECT.init_y = WINDOW_HEIGHT / 5;
-    PLAYER_OBJECT.color                    = 0xFFFFFFFF;
-    PLAYER_OBJECT.animations               = NULL;
-    PLAYER_OBJECT.number_of_animations     = 0;
+    MEMORY.tracking = true;
 }
 
-//==========Player Action==========//
-#define MAX_PLAYER_FIRES 20
-Object *player_fires[MAX_PLAYER_FIRES];
+static void link_allocation(Allocation *block)
+{
+    pthread_mutex_lock(&MEMORY.mutex);
+    block->prev = NULL;
+    block->next = MEMORY.blocks;
+    if (MEMORY.blocks)
+        MEMORY.blocks->prev = block;
+    MEMORY.blocks      = block;
+    MemoryStats *stats = &MEMORY.stats[block->tag];
+    stats->live += block->size;
+    stats->allocations++;
+    if (stats->live > stats->peak)
+        stats->peak = stats->live;
+    pthread_mutex_unlock(&MEMORY.mutex);
+}
 
-#define MAX_ENEMY_FIRES 50
-Object *enemy_fires[MAX_ENEMY_FIRES];
+static void unlink_allocation(Allocation *block)
+{
+    pthread_mutex_lock(&MEMORY.mutex);
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        MEMORY.blocks = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    MemoryStats *stats = &MEMORY.stats[block->tag];
+    stats->live -= block->size;
+    stats->frees++;
+    pthread_mutex_unlock(&MEMORY.mutex);
+}
 
-void initialize_fires()
+void *tracked_malloc(MemoryTag tag, size_t size, const char *file, int line)
 {
-    for (int i = 0; i < MAX_PLAYER_FIRES; i++)
-        player_fires[i] = NULL;
-    for (int i = 0; i < MAX_ENEMY_FIRES; i++)
-        enemy_fires[i] = NULL;
+    if (!MEMORY.tracking)
+        return malloc(size);
+    Allocation *block = malloc(ALLOCATION_HEADER_SIZE + size);
+    if (!block)
+        return NULL;
+    *block = (Allocation){ .file = file, .line = line, .tag = tag, .size = size };
+    link_allocation(block);
+    return (uint8_t *)block + ALLOCATION_HEADER_SIZE;
 }
 
-#define PLAYER_FIRE_SPEED  0.3
-#define PLAYER_ENEMY_SPEED 0.1
+void *tracked_calloc(MemoryTag tag, size_t count, size_t size, const char *file, int line)
+{
+    if (!MEMORY.tracking)
+        return calloc(count, size);
+    if (size && count > SIZE_MAX / size)
+        return NULL;
+    void *pointer = tracked_malloc(tag, count * size, file, line);
+    if (pointer)
+        memset(pointer, 0, count * size);
+    return pointer;
+}
 
-void moving_fires()
+void tracked_free(void *pointer)
 {
-    for (int i = 0; i < MAX_PLAYER_FIRES; i++) {
-        if (player_fires[i] != NULL) {
-            player_fires[i]->y += PLAYER_FIRE_SPEED;
-            if (player_fires[i]->y >= WINDOW_HEIGHT) {
-                free(player_fires[i]);
-                player_fires[i] = NULL;
-            }
-        }
-    }
-    for (int i = 0; i < MAX_ENEMY_FIRES; i++) {
-        if (enemy_fires[i] != NULL) {
-            enemy_fires[i]->y -= PLAYER_ENEMY_SPEED;
-            if (enemy_fires[i]->y <= 0) {
-                free(enemy_fires[i]);
-                enemy_fires[i] = NULL;
-            }
-        }
+    if (!MEMORY.tracking || !pointer) {
+        free(pointer);
+        return;
     }
+    Allocation *block = (Allocation *)((uint8_t *)pointer - ALLOCATION_HEADER_SIZE);
+    unlink_allocation(block);
+    free(block);
 }
 
-void spawn_player_fire(Object *player, uint32_t *pixels)
+// the block keeps its tag, the call site moves to the realloc
+void *tracked_realloc(MemoryTag tag, void *pointer, size_t size, const char *file, int line)
 {
-    Object *fire          = malloc(sizeof(Object));
-    fire->curr_sprite          = create_new_sprite(1, 3);
-    fire->curr_sprite->data    = malloc(sizeof(uint8_t) * 3);
-    fire->curr_sprite->data[0] = 1;
-    fire->curr_sprite->data[1] = 1;
-    fire->curr_sprite->data[2] = 1;
-    fire->curr_sprite->x = fire->x = player->x;
-    fire->curr_sprite->y = fire->y = player->y;
-    fire->color = player->color;
-    for (size_t i = 0; i < MAX_PLAYER_FIRES; i++) {
-        if (player_fires[i] == NULL) {
-            player_fires[i] = fire;
-            return;
-        }
+    if (!MEMORY.tracking)
+        return realloc(pointer, size);
+    if (!pointer)
+        return tracked_malloc(tag, size, file, line);
+    Allocation *block = (Allocation *)((uint8_t *)pointer - ALLOCATION_HEADER_SIZE);
+    unlink_allocation(block);
+    Allocation *moved = realloc(block, ALLOCATION_HEADER_SIZE + size);
+    if (!moved) {
+        link_allocation(block);
+        return NULL;
     }
-    fprintf(stderr, "ERROR: Could not spawn a new fire anymore\n");
+    moved->file = file;
+    moved->line = line;
+    moved->size = size;
+    link_allocation(moved);
+    return (uint8_t *)moved + ALLOCATION_HEADER_SIZE;
 }
 
-#define PLAYER_SPEED          0.2f
-#define PLAYER_FIRE_RATE_TIME 0.4f
+void *image_malloc(size_t size)
+{
+    return memory_alloc(MEMORY_ASSETS, size);
+}
 
-void check_player_action(GLFWwindow *window, Object *player, uint32_t *pixels)
+void *image_realloc(void *pointer, size_t size)
 {
-    static double last_spawn_fire = 0;
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        if (player->x + PLAYER_SPEED < WINDOW_WIDTH)
-            player->x += PLAYER_SPEED;
-    }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        if (player->x - PLAYER_SPEED >= 0)
-            player->x -= PLAYER_SPEED;
-    }
-    if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-        double curr_time = glfwGetTime();
-        if (curr_time - last_spawn_fire > PLAYER_FIRE_RATE_TIME) {
-            spawn_player_fire(player, pixels);
-            last_spawn_fire = curr_time;
-        }
-    }
+    return memory_realloc(MEMORY_ASSETS, pointer, size);
 }
 
-//==========Enemy==========//
-void check_to_spawn_enemy_fires(Object **enemies, size_t number_of_emmies)
-{
-    if ((rand() % 10000) == 0) {
-        Object *fire          = malloc(sizeof(Object));
-        fire->curr_sprite          = create_new_sprite(1, 3);
-        fire->curr_sprite->data    = malloc(sizeof(uint8_t) * 2);
-        fire->curr_sprite->data[0] = 1;
-        fire->curr_sprite->data[1] = 1;
-        fire->curr_sprite->data[2] = 1;
-
-        int index = 0;
-        int count = 0;
-        do {
-            index = rand() % number_of_emmies;
-            count++;
-        } while (enemies[index] == NULL || (count < (number_of_emmies * 2)));
-
-        if (enemies[index] == NULL)
-            return;
+void image_free(void *pointer)
+{
+    memory_free(pointer);
+}
 
-        Object *enemy   = enemies[index];
-        fire->curr_sprite->x = fire->x = enemy->x;
-        fire->curr_sprite->y = fire->y = enemy->y;
-        fire->color     = enemy->color;
-        for (size_t i = 0; i < MAX_ENEMY_FIRES; i++) {
-            if (enemy_fires[i] == NULL) {
-                enemy_fires[i] = fire;
-                return;
+// call last thing before exit, everything still live counts as a leak
+void print_memory_report()
+{
+    if (!MEMORY.tracking)
+        return;
+    pthread_mutex_lock(&MEMORY.mutex);
+    double seconds = (now_ns() - STARTUP_TIME) / 1e9;
+    for (size_t tag = 0; tag < NUMBER_OF_MEMORY_TAGS; tag++) {
+        MemoryStats *stats = &MEMORY.stats[tag];
+        printf("INFO : Memory of %s: %zu bytes live, %zu peak, %zu allocations (%.1f/s), %zu frees\n",
+               MEMORY_TAG_NAMES[tag], stats->live, stats->peak, stats->allocations, stats->allocations / seconds, stats->frees);
+    }
+
+    // group the leaks by call site
+    typedef struct {
+        const char *file;
+        int line;
+        MemoryTag tag;
+        size_t blocks, bytes;
+    } LeakSite;
+    LeakSite sites[MEMORY_MAX_LEAK_SITES];
+    size_t number_of_sites = 0;
+    size_t other_blocks    = 0;
+    for (Allocation *block = MEMORY.blocks; block; block = block->next) {
+        size_t i = 0;
+        while (i < number_of_sites && (sites[i].line != block->line || strcmp(sites[i].file, block->file) != 0))
+            i++;
+        if (i == number_of_sites) {
+            if (number_of_sites == MEMORY_MAX_LEAK_SITES) {
+                other_blocks++;
+                continue;
             }
+            sites[number_of_sites++] = (LeakSite){ block->file, block->line, block->tag, 0, 0 };
         }
-        fprintf(stderr, "ERROR: Could not spawn a new fire anymore\n");
+        sites[i].blocks++;
+        sites[i].bytes += block->size;
     }
+    for (size_t i = 0; i < number_of_sites; i++)
+        fprintf(stderr, "ERROR: Leaked %zu bytes in %zu block(s) of %s allocated at %s:%d\n",
+                sites[i].bytes, sites[i].blocks, MEMORY_TAG_NAMES[sites[i].tag], sites[i].file, sites[i].line);
+    if (other_blocks)
+        fprintf(stderr, "ERROR: Leaked %zu more block(s) from other places\n", other_blocks);
+    if (number_of_sites == 0)
+        printf("INFO : No memory leaked\n");
+    pthread_mutex_unlock(&MEMORY.mutex);
 }
 
-#define ENEMY_SPEED 2
+//==========Timer Wheel==========//
+// Game code schedules callbacks a number of ticks ahead instead of checking
+// a timestamp every tick. Timers sit in a hierarchical timing wheel: level 0
+// has one slot per tick, every higher level one slot per whole turn of the
+// level below. Scheduling and cancelling are O(1). Advancing runs the one
+// slot that is due and, once per turn, moves the next slot of the level above
+// down, so a tick costs as much as the timers that fire, not as the timers
+// that exist.
+// The wheel belongs to the simulation. Use it from the main thread or from a
+// job that runs alone, never from parallel jobs.
+#define TIMER_WHEEL_BITS   8
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4 // reaches almost 2^32 ticks ahead, later timers are clamped
+#define MAX_TIMERS         4096
+#define TIMER_NONE         UINT32_MAX
 
-inline void moving_enemy_animation(Object *enemy, double curr_time)
+typedef void (*TimerFunc)(void *data);
+
+// index + 1 in the low half, generation in the high half, 0 is no timer
+typedef uint64_t TimerId;
+
+typedef struct {
+    TimerFunc func;
+    void *data;
+    uint64_t expires; // tick
+    uint32_t bucket;  // level * TIMER_WHEEL_SLOTS + slot
+    uint32_t next, prev;
+    uint32_t generation;
+    bool active;
+} Timer;
+
+typedef struct {
+    Timer timers[MAX_TIMERS];
+    uint32_t slots[TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS]; // list heads
+    uint32_t free_list;
+    uint32_t high_water; // timers from here on were never used
+    uint64_t tick;       // last tick that was run
+    size_t number_of_timers;
+} TimerWheel;
+
+static TimerWheel TIMERS;
+
+void init_timer_wheel(TimerWheel *wheel)
 {
-    enemy->x = enemy->init_x + (int)(sin(curr_time * ENEMY_SPEED) * (WINDOW_WIDTH / 16));
+    wheel->tick             = 0;
+    wheel->number_of_timers = 0;
+    for (size_t i = 0; i < TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS; i++)
+        wheel->slots[i] = TIMER_NONE;
+    for (uint32_t i = 0; i < MAX_TIMERS; i++)
+        wheel->timers[i] = (Timer){ .next = i + 1 < MAX_TIMERS ? i + 1 : TIMER_NONE };
+    wheel->free_list  = 0;
+    wheel->high_water = 0;
 }
 
-#define NUMBER_OF_GREEN_ENEMIES_IN_ROW 8
-#define GREEN_ENEMY_WIDTH              12
-#define GREEN_ENEMY_HEIGHT             8
-#define GREEN_ENEMY_ANIMATION_FRAMES   2
-#define GREEN_ENEMY_FRAME_DURATION     0.2
+// the lowest level whose current turn still contains the expiry tick
+static void timer_link(TimerWheel *wheel, uint32_t index)
+{
+    Timer *timer = &wheel->timers[index];
+    size_t level = 0;
+    while (level + 1 < TIMER_WHEEL_LEVELS && (timer->expires ^ wheel->tick) >> (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+    timer->bucket  = level * TIMER_WHEEL_SLOTS + ((timer->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+    uint32_t *head = &wheel->slots[timer->bucket];
+    timer->prev    = TIMER_NONE;
+    timer->next    = *head;
+    if (*head != TIMER_NONE)
+        wheel->timers[*head].prev = index;
+    *head = index;
+}
 
-const static uint8_t green_enemy_frames[GREEN_ENEMY_ANIMATION_FRAMES][GREEN_ENEMY_WIDTH * GREEN_ENEMY_HEIGHT] = {
-    {
-        0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, // ..@......@..
-        0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, // ...@....@...
-        0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, // ..@@@@@@@@..
-        0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 0, // .@@.@@@@.@@.
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@@@@@
-        1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, // @.@@@@@@@@.@
-        1, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 1, // @.@......@.@
-        0, 0, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0  // ...@@..@@...
-    },
-    {
-        0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, // ..@......@..
-        1, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 1, // @..@....@..@
-        1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, // @.@@@@@@@@.@
-        1, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1, 1, // @@@.@@@@.@@@
-        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@@@@@
-        0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, // .@@@@@@@@@@.
-        0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, // ..@......@..
-        0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0  // .@........@.
-    }
-};
+static void timer_unlink(TimerWheel *wheel, uint32_t index)
+{
+    Timer *timer = &wheel->timers[index];
+    if (timer->prev != TIMER_NONE)
+        wheel->timers[timer->prev].next = timer->next;
+    else
+        wheel->slots[timer->bucket] = timer->next;
+    if (timer->next != TIMER_NONE)
+        wheel->timers[timer->next].prev = timer->prev;
+}
 
-Object **create_green_enemies()
+static void timer_release(TimerWheel *wheel, uint32_t index)
 {
-    Object **enemies = malloc(NUMBER_OF_GREEN_ENEMIES_IN_ROW * sizeof(Object));
-    if (!enemies) {
-        fprintf(stderr, "ERROR: Could not malloc memory for list of green enemies. Please buy more RAM!");
-        return NULL;
+    Timer *timer  = &wheel->timers[index];
+    timer->active = false;
+    timer->generation++;
+    timer->next      = wheel->free_list;
+    wheel->free_list = index;
+    wheel->number_of_timers--;
+}
+
+// calls func(data) delay ticks from now, a delay of 0 counts as 1
+TimerId timer_schedule(TimerWheel *wheel, uint64_t delay, TimerFunc func, void *data)
+{
+    if (wheel->free_list == TIMER_NONE) {
+        fprintf(stderr, "ERROR: Could not schedule more than %d timers\n", MAX_TIMERS);
+        return 0;
     }
-    const size_t STRIDE = (WINDOW_WIDTH * 3 / 4) / NUMBER_OF_GREEN_ENEMIES_IN_ROW;
-    for (size_t i = 0; i < NUMBER_OF_GREEN_ENEMIES_IN_ROW; i++) {
-        enemies[i] = malloc(sizeof(Object));
-        if (!enemies[i]) {
-            fprintf(stderr, "ERROR: Could not malloc memory for a green enemy. Please buy more RAM!");
-            continue;
+    // one turn of the top level short, so it never lands in the slot that is due
+    const uint64_t max_delay = ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - ((uint64_t)1 << (TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1)));
+    if (delay == 0)
+        delay = 1;
+    if (delay > max_delay)
+        delay = max_delay;
+    uint32_t index   = wheel->free_list;
+    Timer *timer     = &wheel->timers[index];
+    wheel->free_list = timer->next;
+    if (index >= wheel->high_water)
+        wheel->high_water = index + 1;
+    timer->func      = func;
+    timer->data      = data;
+    timer->expires   = wheel->tick + delay;
+    timer->active    = true;
+    wheel->number_of_timers++;
+    timer_link(wheel, index);
+    return ((uint64_t)timer->generation << 32) | (index + 1);
+}
+
+// cancelling a timer that already fired or was cancelled does nothing
+void timer_cancel(TimerWheel *wheel, TimerId id)
+{
+    uint32_t index = (uint32_t)id - 1;
+    if (id == 0 || index >= MAX_TIMERS)
+        return;
+    Timer *timer = &wheel->timers[index];
+    if (!timer->active || timer->generation != (uint32_t)(id >> 32))
+        return;
+    timer_unlink(wheel, index);
+    timer_release(wheel, index);
+}
+
+// runs the next tick. Callbacks may schedule and cancel timers.
+void timer_wheel_advance(TimerWheel *wheel)
+{
+    wheel->tick++;
+    // at the start of a turn, spread the due slot of the level above over the
+    // levels below. Higher levels first, they can refill the slots below.
+    size_t top = 0;
+    while (top + 1 < TIMER_WHEEL_LEVELS && !(wheel->tick & (((uint64_t)1 << (TIMER_WHEEL_BITS * (top + 1))) - 1)))
+        top++;
+    for (size_t level = top; level > 0; level--) {
+        uint32_t *head = &wheel->slots[level * TIMER_WHEEL_SLOTS + ((wheel->tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK)];
+        uint32_t index = *head;
+        *head          = TIMER_NONE;
+        while (index != TIMER_NONE) {
+            uint32_t next = wheel->timers[index].next;
+            timer_link(wheel, index);
+            index = next;
         }
-        enemies[i]->x = enemies[i]->init_x = (i * STRIDE) + (WINDOW_WIDTH / 8) + (STRIDE / 2);
-        enemies[i]->y = enemies[i]->init_y = WINDOW_HEIGHT * 8 / 10;
-        enemies[i]->color                  = 0x31EDEEFF;
-
-        enemies[i]->number_of_animations  = 1;
-        enemies[i]->animations            = malloc(1 * sizeof(Anim));
-        enemies[i]->animations[0]         = malloc(sizeof(Anim));
-        enemies[i]->animations[0]->frames = malloc(GREEN_ENEMY_ANIMATION_FRAMES * sizeof(Sprite));
-        for (size_t j = 0; j < GREEN_ENEMY_ANIMATION_FRAMES; j++) {
-            enemies[i]->animations[0]->frames[j]       = create_new_sprite(GREEN_ENEMY_WIDTH, GREEN_ENEMY_HEIGHT);
-            enemies[i]->animations[0]->frames[j]->data = green_enemy_frames[j];
-        }
-        enemies[i]->animations[0]->loop             = true;
-        enemies[i]->animations[0]->frame_duration   = GREEN_ENEMY_FRAME_DURATION;
-        enemies[i]->animations[0]->number_of_frames = GREEN_ENEMY_ANIMATION_FRAMES;
-        enemies[i]->animations[0]->time             = 0;
-        enemies[i]->animations[0]->start_time       = 0;
-        enemies[i]->curr_sprite                     = enemies[i]->animations[0]->frames[0];
-        printf("INFO : A green enemy was created in position (%zu, %zu)\n", (size_t)enemies[i]->x, (size_t)enemies[i]->y);
     }
-    return enemies;
+    uint32_t *head = &wheel->slots[wheel->tick & TIMER_WHEEL_MASK];
+    while (*head != TIMER_NONE) {
+        uint32_t index = *head;
+        Timer timer    = wheel->timers[index];
+        timer_unlink(wheel, index);
+        timer_release(wheel, index);
+        timer.func(timer.data);
+    }
 }
 
-#define NUMBER_OF_RED_ENEMIES_IN_ROW 8
-#define RED_ENEMY_WIDTH              8
-#define RED_ENEMY_HEIGHT             8
-#define RED_ENEMY_ANIMATION_FRAMES   2
-#define RED_ENEMY_FRAME_DURATION     0.2
+//==========Arena==========//
+// Linear allocators for data that only lives for a short while. Allocating is
+// bumping a pointer and everything is freed at once by resetting, so the loop
+// does not have to go to the heap for scratch memory. Running out is a bug in
+// the sizes below: debug builds abort, release builds get NULL and have to
+// cope.
+#define ARENA_ALIGNMENT    16
+#define FRAME_ARENA_SIZE   (512 * 1024)
+#define SCRATCH_ARENA_SIZE (64 * 1024)
 
-const static uint8_t red_enemy_frames[RED_ENEMY_ANIMATION_FRAMES][RED_ENEMY_WIDTH * RED_ENEMY_HEIGHT] = {
-    {
-        0, 0, 0, 1, 1, 0, 0, 0, // ...@@...
-        0, 0, 1, 1, 1, 1, 0, 0, // ..@@@@..
-        0, 1, 1, 1, 1, 1, 1, 0, // .@@@@@@.
-        1, 1, 0, 1, 1, 0, 1, 1, // @@.@@.@@
-        1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@
-        0, 1, 0, 1, 1, 0, 1, 0, // .@.@@.@.
-        1, 0, 0, 0, 0, 0, 0, 1, // @......@
-        0, 1, 0, 0, 0, 0, 1, 0  // .@....@.
-    },
-    {
-        0, 0, 0, 1, 1, 0, 0, 0, // ...@@...
-        0, 0, 1, 1, 1, 1, 0, 0, // ..@@@@..
-        0, 1, 1, 1, 1, 1, 1, 0, // .@@@@@@.
-        1, 1, 0, 1, 1, 0, 1, 1, // @@.@@.@@
-        1, 1, 1, 1, 1, 1, 1, 1, // @@@@@@@@
-        0, 0, 1, 0, 0, 1, 0, 0, // ..@..@..
-        0, 1, 0, 1, 1, 0, 1, 0, // .@.@@.@.
-        1, 0, 1, 0, 0, 1, 0, 1  // @.@..@.@
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t peak;
+    const char *name;
+} Arena;
+
+// reset at the top of every iteration of the main loop, only the main thread
+// allocates from it but jobs of the tick may read what it gave out
+static Arena FRAME_ARENA;
+
+bool init_arena(Arena *arena, const char *name, size_t size)
+{
+    *arena      = (Arena){ .size = size, .name = name };
+    arena->base = memory_alloc(MEMORY_ARENAS, size);
+    if (!arena->base) {
+        fprintf(stderr, "ERROR: Could not malloc memory for the %s arena. Please buy more RAM!\n", name);
+        return false;
     }
-};
+    return true;
+}
 
-Object **create_red_enemies()
+void free_arena(Arena *arena)
 {
-    Object **enemies = malloc(NUMBER_OF_GREEN_ENEMIES_IN_ROW * sizeof(Object));
-    if (!enemies) {
-        fprintf(stderr, "ERROR: Could not malloc memory for list of red enemies. Please buy more RAM!");
+    memory_free(arena->base);
+    arena->base = NULL;
+    arena->size = arena->used = 0;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size_t begin = (arena->used + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (begin > arena->size || size > arena->size - begin) {
+        fprintf(stderr, "ERROR: The %s arena is out of memory, %zu bytes asked with %zu of %zu used\n",
+                arena->name, size, arena->used, arena->size);
+#ifndef NDEBUG
+        abort();
+#endif
         return NULL;
     }
-    const size_t STRIDE = (WINDOW_WIDTH * 3 / 4) / NUMBER_OF_RED_ENEMIES_IN_ROW;
-    for (size_t i = 0; i < NUMBER_OF_RED_ENEMIES_IN_ROW; i++) {
-        enemies[i] = malloc(sizeof(Object));
-        if (!enemies[i]) {
-            fprintf(stderr, "ERROR: Could not malloc memory for a red enemy. Please buy more RAM!");
-            continue;
-        }
-        enemies[i]->x = enemies[i]->init_x = (i * STRIDE) + (WINDOW_WIDTH / 8) + (STRIDE / 2);
-        enemies[i]->y = enemies[i]->init_y = WINDOW_HEIGHT * 7 / 10;
-        enemies[i]->color                  = 0xEB1A40FF;
-
-        enemies[i]->number_of_animations  = 1;
-        enemies[i]->animations            = malloc(1 * sizeof(Anim));
-        enemies[i]->animations[0]         = malloc(sizeof(Anim));
-        enemies[i]->animations[0]->frames = malloc(RED_ENEMY_ANIMATION_FRAMES * sizeof(Sprite));
-        for (size_t j = 0; j < RED_ENEMY_ANIMATION_FRAMES; j++) {
-            enemies[i]->animations[0]->frames[j]       = create_new_sprite(RED_ENEMY_WIDTH, RED_ENEMY_HEIGHT);
-            enemies[i]->animations[0]->frames[j]->data = red_enemy_frames[j];
-        }
-        enemies[i]->animations[0]->loop             = true;
-        enemies[i]->animations[0]->frame_duration   = RED_ENEMY_FRAME_DURATION;
-        enemies[i]->animations[0]->number_of_frames = RED_ENEMY_ANIMATION_FRAMES;
-        enemies[i]->animations[0]->time             = 0;
-        enemies[i]->animations[0]->start_time       = 0;
-        enemies[i]->curr_sprite                     = enemies[i]->animations[0]->frames[0];
-        printf("INFO : A red enemy was created in position (%zu, %zu)\n", (size_t)enemies[i]->x, (size_t)enemies[i]->y);
-    }
-    return enemies;
+    arena->used = begin + size;
+    if (arena->used > arena->peak)
+        arena->peak = arena->used;
+    return arena->base + begin;
 }
 
-void delete_enemies(Object **enemies, size_t number_of_enemies)
+// frees everything allocated since the mark was taken
+static inline size_t arena_mark(Arena *arena)
 {
-    for (size_t i = 0; i < number_of_enemies; i++)
-        delete_object(enemies[i]);
-    free(enemies);
+    return arena->used;
 }
 
-//==========Main==========//
-int main()
+static inline void arena_restore(Arena *arena, size_t mark)
 {
-    init_glfw();
-    GLFWwindow *window = create_window();
-    if (!window)
-        return -1;
+    arena->used = mark;
+}
+
+static inline void arena_reset(Arena *arena)
+{
+    arena->used = 0;
+}
+
+void print_arena_peak(const Arena *arena)
+{
+    printf("INFO : Peak of the %s arena %zu of %zu bytes\n", arena->name, arena->peak, arena->size);
+}
+
+//==========Hash==========//
+#define HASH_SEED 0xcbf29ce484222325ull
+
+// 64 bit FNV-1a, pass HASH_SEED or the result of a previous call as seed
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash        = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static inline uint64_t hash_string(const char *string, uint64_t seed)
+{
+    return string ? hash_bytes(string, strlen(string) + 1, seed) : seed;
+}
+
+//==========Cache==========//
+// Things that are expensive to rebuild (shader binaries, decoded sprites) are
+// kept in $XDG_CACHE_HOME/space_invaders, ~/.cache/space_invaders or --cache-dir.
+static char CACHE_DIR[512];
+
+bool init_cache_dir(const char *override_dir)
+{
+    const char *xdg  = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if (override_dir)
+        snprintf(CACHE_DIR, sizeof(CACHE_DIR), "%s", override_dir);
+    else if (xdg && *xdg)
+        snprintf(CACHE_DIR, sizeof(CACHE_DIR), "%s/space_invaders", xdg);
+    else if (home && *home)
+        snprintf(CACHE_DIR, sizeof(CACHE_DIR), "%s/.cache/space_invaders", home);
+    else
+        snprintf(CACHE_DIR, sizeof(CACHE_DIR), "cache");
+
+    // create every missing directory on the way
+    char path[sizeof(CACHE_DIR)];
+    snprintf(path, sizeof(path), "%s", CACHE_DIR);
+    for (char *c = path + 1;; c++) {
+        if (*c != '/' && *c != '\0')
+            continue;
+        char end = *c;
+        *c       = '\0';
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "ERROR: Could not create cache directory %s\n", path);
+            CACHE_DIR[0] = '\0';
+            return false;
+        }
+        if (end == '\0')
+            break;
+        *c = end;
+    }
+    return true;
+}
+
+// reads a whole cache entry, the caller frees it. NULL if there is none.
+void *read_cache_file(const char *name, size_t *size)
+{
+    if (!CACHE_DIR[0])
+        return NULL;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, name);
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    void *data = length > 0 ? memory_alloc(MEMORY_ASSETS, length) : NULL;
+    if (data && fread(data, 1, length, file) != (size_t)length) {
+        memory_free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+// writes to a temporary file first so that readers never see half an entry
+bool write_cache_file(const char *name, const void *header, size_t header_size, const void *data, size_t size)
+{
+    if (!CACHE_DIR[0])
+        return false;
+    char path[1024], temp_path[1100];
+    snprintf(path, sizeof(path), "%s/%s", CACHE_DIR, name);
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+    FILE *file = fopen(temp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not write cache file %s\n", temp_path);
+        return false;
+    }
+    bool ok = fwrite(header, 1, header_size, file) == header_size && fwrite(data, 1, size, file) == size;
+    ok      = (fclose(file) == 0) && ok;
+    if (!ok || rename(temp_path, path) != 0) {
+        fprintf(stderr, "ERROR: Could not write cache file %s\n", path);
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+//==========Window==========//
+#define WINDOW_WIDTH  512
+#define WINDOW_HEIGHT 256
+#define WINDOW_TITLE  "space invaders"
+
+void init_glfw()
+{
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    printf("INFO : GLFW initialize!\n");
+}
+
+GLFWwindow *create_window()
+{
+    GLFWwindow *window;
+    GLFWmonitor **monitors = { 0 };
+    int count_monitors     = 0;
+    bool full_screen       = false;
+    if (full_screen) {
+        monitors = glfwGetMonitors(&count_monitors);
+        if (!monitors) {
+            fprintf(stderr, "ERROR: Could not found any monitor!\n");
+            return NULL;
+        }
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, monitors[0], NULL);
+    } else {
+        window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    }
+    if (!window) {
+        fprintf(stderr, "ERROR: Could not create window!\n");
+        return NULL;
+    }
+    printf("INFO : GLFW window has been created!\n");
+    glfwMakeContextCurrent(window);
+    return window;
+}
+
+//==========Resources==========//
+// tools/asset_packer packs everything in resources/ into one asset pack (see
+// asset_pack.h) and the build compiles that pack into the executable, so
+// normally nothing is read from disk. --asset-pack maps a pack file instead.
+// Either way assets are used in place: opening a pack only checks its header
+// and a lookup is a binary search, so startup does not grow with the number
+// of assets.
+// While developing, --resource-dir, SPACE_INVADERS_RESOURCE_DIR or the
+// RESOURCE_OVERRIDE_DIR cmake option name a directory whose files win over
+// the packed ones.
+#ifndef RESOURCE_OVERRIDE_DIR
+#define RESOURCE_OVERRIDE_DIR ""
+#endif
+
+#define EMBEDDED_ASSET_PACK "space_invaders.pak"
+
+static const char *RESOURCE_DIR = RESOURCE_OVERRIDE_DIR;
+
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    const AssetPackEntry *entries;
+    uint32_t number_of_entries;
+    bool mapped; // base comes from mmap and has to be unmapped
+    bool verify; // check the hash of every asset that is loaded
+} AssetPack;
+
+static AssetPack ASSET_PACK;
+
+typedef struct {
+    const uint8_t *data; // followed by a 0 byte, text can be used as a string
+    size_t size;
+    char *owned; // set when the data was read from disk
+} Resource;
+
+// the buffer has a 0 byte after the content
+char *read_entire_file(const char *filename, size_t *size)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR: Could not open file %s\n", filename);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *buffer = memory_alloc(MEMORY_ASSETS, sizeof(char) * (length + 1));
+    if (buffer == NULL) {
+        fprintf(stderr, "ERROR: Could not malloc memory for reading a file. Please buy more RAM!");
+        fclose(file);
+        return NULL;
+    }
+    size_t actual_size  = fread(buffer, sizeof(char), length, file);
+    buffer[actual_size] = '\0';
+    fclose(file);
+
+    if (size)
+        *size = actual_size;
+    return buffer;
+}
+
+// only the header and the size of the index are checked here, entries are
+// checked when they are looked up
+bool open_asset_pack(AssetPack *pack, const void *data, size_t size)
+{
+    const AssetPackHeader *header = data;
+    if (size < sizeof(AssetPackHeader) || header->magic != ASSET_PACK_MAGIC) {
+        fprintf(stderr, "ERROR: Not an asset pack\n");
+        return false;
+    }
+    if (header->version != ASSET_PACK_VERSION) {
+        fprintf(stderr, "ERROR: Asset pack version %u is not supported, expected %u\n", header->version, ASSET_PACK_VERSION);
+        return false;
+    }
+    if (header->size != size || (size - sizeof(AssetPackHeader)) / sizeof(AssetPackEntry) < header->number_of_entries) {
+        fprintf(stderr, "ERROR: Asset pack is truncated\n");
+        return false;
+    }
+    pack->base              = data;
+    pack->size              = size;
+    pack->entries           = (const AssetPackEntry *)(header + 1);
+    pack->number_of_entries = header->number_of_entries;
+    pack->mapped            = false;
+    return true;
+}
+
+bool map_asset_pack(AssetPack *pack, const char *path)
+{
+    int file = open(path, O_RDONLY);
+    if (file < 0) {
+        fprintf(stderr, "ERROR: Could not open asset pack %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        fprintf(stderr, "ERROR: Could not read asset pack %s\n", path);
+        close(file);
+        return false;
+    }
+    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Could not map asset pack %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    if (!open_asset_pack(pack, data, info.st_size)) {
+        munmap(data, info.st_size);
+        return false;
+    }
+    pack->mapped = true;
+    return true;
+}
+
+void close_asset_pack(AssetPack *pack)
+{
+    if (pack->mapped)
+        munmap((void *)pack->base, pack->size);
+    *pack = (AssetPack){ 0 };
+}
+
+const AssetPackEntry *find_asset(const AssetPack *pack, const char *name)
+{
+    size_t low = 0, high = pack->number_of_entries;
+    while (low < high) {
+        size_t middle               = low + (high - low) / 2;
+        const AssetPackEntry *entry = &pack->entries[middle];
+        int order                   = strncmp(name, entry->name, ASSET_NAME_LENGTH);
+        if (order == 0) {
+            if (entry->offset > pack->size || pack->size - entry->offset <= entry->size) {
+                fprintf(stderr, "ERROR: Asset %s lies outside of the pack\n", name);
+                return NULL;
+            }
+            return entry;
+        }
+        if (order < 0)
+            high = middle;
+        else
+            low = middle + 1;
+    }
+    return NULL;
+}
+
+bool init_resources(const char *override_dir, const char *pack_path, bool verify)
+{
+    const char *env = getenv("SPACE_INVADERS_RESOURCE_DIR");
+    if (override_dir)
+        RESOURCE_DIR = override_dir;
+    else if (env && *env)
+        RESOURCE_DIR = env;
+    if (RESOURCE_DIR[0])
+        printf("INFO : Resources in %s override the packed ones\n", RESOURCE_DIR);
+
+    if (pack_path) {
+        if (!map_asset_pack(&ASSET_PACK, pack_path))
+            return false;
+        printf("INFO : Mapped asset pack %s with %u assets\n", pack_path, ASSET_PACK.number_of_entries);
+    } else {
+        const EmbeddedResource *embedded = NULL;
+        for (size_t i = 0; i < NUMBER_OF_EMBEDDED_RESOURCES; i++)
+            if (strcmp(EMBEDDED_RESOURCES[i].name, EMBEDDED_ASSET_PACK) == 0)
+                embedded = &EMBEDDED_RESOURCES[i];
+        if (!embedded || !open_asset_pack(&ASSET_PACK, embedded->data, embedded->size)) {
+            fprintf(stderr, "ERROR: The embedded asset pack is missing or broken\n");
+            return false;
+        }
+    }
+    ASSET_PACK.verify = verify;
+    return true;
+}
+
+// name is the path relative to resources/, e.g. "pixel_vertex.glsl"
+bool load_resource(const char *name, Resource *resource)
+{
+    if (RESOURCE_DIR[0]) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", RESOURCE_DIR, name);
+        if (access(path, R_OK) == 0) {
+            size_t size;
+            char *data = read_entire_file(path, &size);
+            if (data) {
+                *resource = (Resource){ (const uint8_t *)data, size, data };
+                return true;
+            }
+        }
+    }
+    const AssetPackEntry *entry = find_asset(&ASSET_PACK, name);
+    if (!entry) {
+        fprintf(stderr, "ERROR: Could not find resource %s\n", name);
+        return false;
+    }
+    const uint8_t *data = ASSET_PACK.base + entry->offset;
+    if (ASSET_PACK.verify && hash_bytes(data, entry->size, HASH_SEED) != entry->hash) {
+        fprintf(stderr, "ERROR: Resource %s does not match its hash, the asset pack is corrupt\n", name);
+        return false;
+    }
+    *resource = (Resource){ data, entry->size, NULL };
+    return true;
+}
+
+void release_resource(Resource *resource)
+{
+    memory_free(resource->owned);
+    *resource = (Resource){ 0 };
+}
+
+//==========Hot Reload==========//
+// --hot-reload watches the resource directory with inotify on a background
+// thread. The thread only flags what changed. The render thread picks the
+// flags up between two frames, when no raster job is reading sprites, and
+// rebuilds the shader program or the sprite sheet there.
+#define HOT_RELOAD_SHADERS   (1u << 0)
+#define HOT_RELOAD_SPRITES   (1u << 1)
+#define HOT_RELOAD_POLL_MS   100
+#define HOT_RELOAD_MAX_DEPTH 4
+
+typedef struct {
+    int inotify;
+    pthread_t thread;
+    atomic_bool running;
+    atomic_uint pending;
+} HotReload;
+
+static HotReload HOT_RELOAD = { .inotify = -1 };
+
+static bool has_suffix(const char *name, const char *suffix)
+{
+    size_t length = strlen(name), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+// inotify is not recursive, every directory needs its own watch
+static void watch_directory(int inotify, const char *path, int depth)
+{
+    // only complete writes, editors that save by renaming give IN_MOVED_TO
+    if (inotify_add_watch(inotify, path, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        fprintf(stderr, "ERROR: Could not watch %s: %s\n", path, strerror(errno));
+        return;
+    }
+    DIR *dir = depth < HOT_RELOAD_MAX_DEPTH ? opendir(path) : NULL;
+    if (!dir)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char child[1024];
+        struct stat info;
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        if (stat(child, &info) == 0 && S_ISDIR(info.st_mode))
+            watch_directory(inotify, child, depth + 1);
+    }
+    closedir(dir);
+}
+
+void *hot_reload_thread_main(void *arg)
+{
+    HotReload *hot_reload = arg;
+    _Alignas(struct inotify_event) char buffer[4096];
+    struct pollfd poll_fd = { .fd = hot_reload->inotify, .events = POLLIN };
+    while (atomic_load(&hot_reload->running)) {
+        if (poll(&poll_fd, 1, HOT_RELOAD_POLL_MS) <= 0)
+            continue;
+        ssize_t length = read(hot_reload->inotify, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < length;) {
+            const struct inotify_event *event = (const struct inotify_event *)(buffer + i);
+            i += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0)
+                continue;
+            if (has_suffix(event->name, ".glsl"))
+                atomic_fetch_or(&hot_reload->pending, HOT_RELOAD_SHADERS);
+            else if (has_suffix(event->name, ".png") || has_suffix(event->name, ".sheet"))
+                atomic_fetch_or(&hot_reload->pending, HOT_RELOAD_SPRITES);
+        }
+    }
+    return NULL;
+}
+
+// only files in the override directory can change, the pack is read only
+bool start_hot_reload(HotReload *hot_reload)
+{
+    if (!RESOURCE_DIR[0]) {
+        fprintf(stderr, "ERROR: Hot reload needs a resource directory, use --resource-dir\n");
+        return false;
+    }
+    hot_reload->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hot_reload->inotify < 0) {
+        fprintf(stderr, "ERROR: Could not initialize inotify: %s\n", strerror(errno));
+        return false;
+    }
+    watch_directory(hot_reload->inotify, RESOURCE_DIR, 0);
+    atomic_store(&hot_reload->running, true);
+    if (pthread_create(&hot_reload->thread, NULL, hot_reload_thread_main, hot_reload) != 0) {
+        fprintf(stderr, "ERROR: Could not start the hot reload thread\n");
+        atomic_store(&hot_reload->running, false);
+        close(hot_reload->inotify);
+        hot_reload->inotify = -1;
+        return false;
+    }
+    printf("INFO : Watching %s for changes\n", RESOURCE_DIR);
+    return true;
+}
+
+void stop_hot_reload(HotReload *hot_reload)
+{
+    if (!atomic_exchange(&hot_reload->running, false))
+        return;
+    pthread_join(hot_reload->thread, NULL);
+    close(hot_reload->inotify);
+    hot_reload->inotify = -1;
+}
+
+//==========Shader==========//
+unsigned int compile_shader_source(const char *vertex_shader_source, const char *fragment_shader_source)
+{
+    int success;
+    char msg[512];
+    // vertex shader
+    unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertex_shader, 1, &vertex_shader_source, NULL);
+    glCompileShader(vertex_shader);
+    // check for shader compile errors
+    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(vertex_shader, 512, NULL, msg);
+        fprintf(stderr, "ERROR: Vertex shader compilation failed: %s\n", msg);
+    }
+    // fragment shader
+    unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragment_shader, 1, &fragment_shader_source, NULL);
+    glCompileShader(fragment_shader);
+    // check for shader compile errors
+    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(fragment_shader, 512, NULL, msg);
+        fprintf(stderr, "ERROR: Fragment shader compilation failed: %s\n", msg);
+    }
+    // link shaders
+    unsigned int shader_program = glCreateProgram();
+    glAttachShader(shader_program, vertex_shader);
+    glAttachShader(shader_program, fragment_shader);
+    if (glProgramParameteri)
+        glProgramParameteri(shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(shader_program);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    // check for linking errors, this also fails when a shader did not compile
+    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(shader_program, 512, NULL, msg);
+        fprintf(stderr, "ERROR: Shader linking failed: %s\n", msg);
+        glDeleteProgram(shader_program);
+        return 0;
+    }
+
+    printf("INFO : Shader compilation is done!\n");
+    return shader_program;
+}
+
+// A linked program binary is only valid for the same sources on the same
+// driver, so the cache key hashes both. The driver may still reject a binary
+// (e.g. after an update that kept the version string), then we compile again.
+#define SHADER_CACHE_MAGIC   0x42505349 // "ISPB"
+#define SHADER_CACHE_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+} ShaderCacheHeader;
+
+static unsigned int load_program_binary(const char *cache_name, uint64_t key)
+{
+    size_t size;
+    uint8_t *data = read_cache_file(cache_name, &size);
+    if (!data)
+        return 0;
+    ShaderCacheHeader header;
+    unsigned int shader_program = 0;
+    if (size >= sizeof(header)) {
+        memcpy(&header, data, sizeof(header));
+        if (header.magic == SHADER_CACHE_MAGIC && header.version == SHADER_CACHE_VERSION && header.key == key && header.length == size - sizeof(header)) {
+            shader_program = glCreateProgram();
+            glProgramBinary(shader_program, header.format, data + sizeof(header), header.length);
+            int success;
+            glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+            if (!success) {
+                fprintf(stderr, "ERROR: Driver rejected the cached shader binary, compiling again\n");
+                glDeleteProgram(shader_program);
+                shader_program = 0;
+            }
+        }
+    }
+    memory_free(data);
+    return shader_program;
+}
+
+static void store_program_binary(const char *cache_name, uint64_t key, unsigned int shader_program)
+{
+    int length = 0;
+    glGetProgramiv(shader_program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    void *binary = memory_alloc(MEMORY_ASSETS, length);
+    if (!binary)
+        return;
+    GLenum format;
+    glGetProgramBinary(shader_program, length, &length, &format, binary);
+    ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, format, (uint32_t)length };
+    write_cache_file(cache_name, &header, sizeof(header), binary, length);
+    memory_free(binary);
+}
+
+// loads the shader resources and compiles them, with a program binary cache in front
+unsigned int load_shader(const char *vertex_name, const char *fragment_name)
+{
+    int64_t start = now_ns();
+    Resource vertex_shader, fragment_shader;
+    if (!load_resource(vertex_name, &vertex_shader))
+        return 0;
+    if (!load_resource(fragment_name, &fragment_shader)) {
+        release_resource(&vertex_shader);
+        return 0;
+    }
+    const char *vertex_shader_source   = (const char *)vertex_shader.data;
+    const char *fragment_shader_source = (const char *)fragment_shader.data;
+
+    int number_of_formats = 0;
+    if (glGetProgramBinary && glProgramBinary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &number_of_formats);
+
+    unsigned int shader_program = 0;
+    bool from_cache             = false;
+    if (number_of_formats > 0) {
+        uint64_t key = hash_string(vertex_shader_source, HASH_SEED);
+        key          = hash_string(fragment_shader_source, key);
+        key          = hash_string((const char *)glGetString(GL_VENDOR), key);
+        key          = hash_string((const char *)glGetString(GL_RENDERER), key);
+        key          = hash_string((const char *)glGetString(GL_VERSION), key);
+        char cache_name[64];
+        snprintf(cache_name, sizeof(cache_name), "shader-%016" PRIx64 ".bin", key);
+
+        shader_program = load_program_binary(cache_name, key);
+        from_cache     = shader_program != 0;
+        if (!shader_program) {
+            shader_program = compile_shader_source(vertex_shader_source, fragment_shader_source);
+            if (shader_program)
+                store_program_binary(cache_name, key, shader_program);
+        }
+    } else {
+        shader_program = compile_shader_source(vertex_shader_source, fragment_shader_source);
+    }
+    release_resource(&vertex_shader);
+    release_resource(&fragment_shader);
+    if (!shader_program)
+        return 0;
+
+    printf("INFO : Shader program ready in %.3f ms (%s)\n", (now_ns() - start) / 1e6, from_cache ? "cached binary" : "compiled");
+    return shader_program;
+}
+
+//==========Sprite==========//
+typedef struct {
+    uint8_t *data;
+    uint32_t width, height;
+    size_t x;
+    size_t y;
+    uint32_t id;
+} Sprite;
+
+// Sprites live here until exit and are shared by the objects that use them.
+// Frame snapshots refer to them by id, so the render thread never sees a
+// sprite that the simulation has already freed.
+#define MAX_SPRITES 256
+static Sprite *SPRITES[MAX_SPRITES];
+static size_t NUMBER_OF_SPRITES = 0;
+
+Sprite *create_new_sprite(uint32_t width, uint32_t height)
+{
+    if (NUMBER_OF_SPRITES >= MAX_SPRITES) {
+        fprintf(stderr, "ERROR: Could not create more than %d sprites\n", MAX_SPRITES);
+        return NULL;
+    }
+    uint8_t *data = memory_alloc(MEMORY_SPRITES, width * height * sizeof(uint8_t));
+    if (data == NULL) {
+        fprintf(stderr, "Error: Cannot malloc memmory for sprite. Please buy more RAM!\n");
+        return NULL;
+    }
+    Sprite *sprite = memory_alloc(MEMORY_SPRITES, sizeof(Sprite));
+    if (sprite == NULL) {
+        fprintf(stderr, "Error: Cannot malloc memmory for sprite. Please buy more RAM!\n");
+        memory_free(data);
+        return NULL;
+    }
+    *sprite = (Sprite){ data, width, height };
+    sprite->id     = NUMBER_OF_SPRITES;
+    SPRITES[NUMBER_OF_SPRITES++] = sprite;
+    return sprite;
+}
+
+void free_sprite(Sprite *sprite)
+{
+    memory_free(sprite->data);
+    sprite->data = NULL;
+}
+
+void free_sprites()
+{
+    for (size_t i = 0; i < NUMBER_OF_SPRITES; i++) {
+        free_sprite(SPRITES[i]);
+        memory_free(SPRITES[i]);
+        SPRITES[i] = NULL;
+    }
+    NUMBER_OF_SPRITES = 0;
+}
+
+//==========Sprite Sheet==========//
+// Sprites are drawn in PNG sprite sheets. A sidecar descriptor names the sheet
+// and lists its frames:
+//     image sprites/sprites.png
+//     player 0 0 11 7          name x y width height, x y is the top left
+// The frames are converted to the one byte per pixel masks Sprite uses and
+// the result is cached keyed by the hash of the descriptor and the image, so
+// later launches do not decode the PNG at all.
+#define SPRITE_SHEET         "sprites/sprites.sheet"
+#define SPRITE_NAME_LENGTH   32
+#define SPRITE_CACHE_MAGIC   0x53505253 // "SRPS"
+#define SPRITE_CACHE_VERSION 1
+
+typedef struct {
+    char name[SPRITE_NAME_LENGTH];
+    uint32_t x, y, width, height;
+} SheetFrame;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t number_of_frames;
+    uint32_t size; // of the frames and masks that follow
+} SpriteCacheHeader;
+
+// the cached data is number_of_frames SheetFrames followed by their masks
+typedef struct {
+    const char *name;
+    Sprite *sprite;
+} NamedSprite;
+
+static NamedSprite NAMED_SPRITES[MAX_SPRITES];
+static size_t NUMBER_OF_NAMED_SPRITES = 0;
+
+Sprite *lookup_sprite(const char *name)
+{
+    for (size_t i = 0; i < NUMBER_OF_NAMED_SPRITES; i++)
+        if (strcmp(NAMED_SPRITES[i].name, name) == 0)
+            return NAMED_SPRITES[i].sprite;
+    return NULL;
+}
+
+Sprite *find_sprite(const char *name)
+{
+    Sprite *sprite = lookup_sprite(name);
+    if (!sprite)
+        fprintf(stderr, "ERROR: There is no sprite called %s\n", name);
+    return sprite;
+}
+
+// fills frames from the descriptor text, returns the number of frames or -1
+int parse_sheet_descriptor(const char *text, char *image, size_t image_size, SheetFrame *frames, size_t max_frames)
+{
+    size_t number_of_frames = 0;
+    size_t line_number      = 0;
+    image[0]                = '\0';
+    for (const char *line = text; *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : line + strlen(line)) {
+        line_number++;
+        while (*line == ' ' || *line == '\t')
+            line++;
+        if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0')
+            continue;
+        char name[256];
+        SheetFrame frame = { 0 };
+        if (strncmp(line, "image ", 6) == 0) {
+            if (sscanf(line + 6, "%255s", name) != 1 || strlen(name) >= image_size)
+                goto bad_line;
+            strcpy(image, name);
+        } else if (sscanf(line, "%255s %u %u %u %u", name, &frame.x, &frame.y, &frame.width, &frame.height) == 5) {
+            if (strlen(name) >= SPRITE_NAME_LENGTH || frame.width == 0 || frame.height == 0)
+                goto bad_line;
+            if (number_of_frames >= max_frames) {
+                fprintf(stderr, "ERROR: A sprite sheet can not have more than %zu frames\n", max_frames);
+                return -1;
+            }
+            strcpy(frame.name, name);
+            frames[number_of_frames++] = frame;
+        } else {
+            goto bad_line;
+        }
+        continue;
+    bad_line:
+        fprintf(stderr, "ERROR: Could not parse line %zu of the sprite sheet descriptor\n", line_number);
+        return -1;
+    }
+    if (!image[0]) {
+        fprintf(stderr, "ERROR: The sprite sheet descriptor does not name an image\n");
+        return -1;
+    }
+    return (int)number_of_frames;
+}
+
+// decodes the sheet and slices it into frames followed by their masks
+uint8_t *convert_sprite_sheet(const Resource *image, const SheetFrame *frames, size_t number_of_frames, size_t *size)
+{
+    int width, height, channels;
+    uint8_t *rgba = stbi_load_from_memory(image->data, (int)image->size, &width, &height, &channels, 4);
+    if (!rgba) {
+        fprintf(stderr, "ERROR: Could not decode sprite sheet: %s\n", stbi_failure_reason());
+        return NULL;
+    }
+    *size = number_of_frames * sizeof(SheetFrame);
+    for (size_t i = 0; i < number_of_frames; i++) {
+        if (frames[i].x + frames[i].width > (uint32_t)width || frames[i].y + frames[i].height > (uint32_t)height) {
+            fprintf(stderr, "ERROR: Sprite %s lies outside of the %dx%d sheet\n", frames[i].name, width, height);
+            stbi_image_free(rgba);
+            return NULL;
+        }
+        *size += frames[i].width * frames[i].height;
+    }
+    uint8_t *converted = memory_alloc(MEMORY_SPRITES, *size);
+    if (!converted) {
+        fprintf(stderr, "ERROR: Could not malloc memory for sprites. Please buy more RAM!\n");
+        stbi_image_free(rgba);
+        return NULL;
+    }
+    memcpy(converted, frames, number_of_frames * sizeof(SheetFrame));
+    uint8_t *mask = converted + number_of_frames * sizeof(SheetFrame);
+    for (size_t i = 0; i < number_of_frames; i++) {
+        for (uint32_t y = 0; y < frames[i].height; y++)
+            for (uint32_t x = 0; x < frames[i].width; x++)
+                *mask++ = rgba[((frames[i].y + y) * width + frames[i].x + x) * 4 + 3] >= 128;
+    }
+    stbi_image_free(rgba);
+    return converted;
+}
+
+bool register_sheet_sprites(const uint8_t *converted, size_t number_of_frames)
+{
+    const SheetFrame *frames = (const SheetFrame *)converted;
+    const uint8_t *mask      = converted + number_of_frames * sizeof(SheetFrame);
+    for (size_t i = 0; i < number_of_frames; i++) {
+        if (NUMBER_OF_NAMED_SPRITES >= MAX_SPRITES)
+            return false;
+        Sprite *sprite = create_new_sprite(frames[i].width, frames[i].height);
+        char *name     = memory_alloc(MEMORY_SPRITES, SPRITE_NAME_LENGTH);
+        if (!sprite || !name)
+            return false;
+        memcpy(sprite->data, mask, frames[i].width * frames[i].height);
+        memcpy(name, frames[i].name, SPRITE_NAME_LENGTH);
+        mask += frames[i].width * frames[i].height;
+        NAMED_SPRITES[NUMBER_OF_NAMED_SPRITES++] = (NamedSprite){ name, sprite };
+    }
+    return true;
+}
+
+// the cache entry has to describe exactly the frames of the descriptor
+bool cached_sheet_matches(const uint8_t *cached, size_t size, uint64_t key, const SheetFrame *frames, size_t number_of_frames)
+{
+    const SpriteCacheHeader *header = (const SpriteCacheHeader *)cached;
+    if (size < sizeof(SpriteCacheHeader) || header->magic != SPRITE_CACHE_MAGIC || header->version != SPRITE_CACHE_VERSION || header->key != key || header->number_of_frames != number_of_frames || header->size != size - sizeof(SpriteCacheHeader))
+        return false;
+    size_t expected = number_of_frames * sizeof(SheetFrame);
+    for (size_t i = 0; i < number_of_frames; i++)
+        expected += frames[i].width * frames[i].height;
+    return header->size == expected && memcmp(header + 1, frames, number_of_frames * sizeof(SheetFrame)) == 0;
+}
+
+// loads the descriptor and its image, key identifies both of them
+int read_sprite_sheet(const char *descriptor_name, SheetFrame *frames, Resource *image, uint64_t *key)
+{
+    Resource descriptor;
+    if (!load_resource(descriptor_name, &descriptor))
+        return -1;
+    char image_name[256];
+    int number_of_frames = parse_sheet_descriptor((const char *)descriptor.data, image_name, sizeof(image_name), frames, MAX_SPRITES);
+    *key                 = hash_bytes(descriptor.data, descriptor.size, HASH_SEED);
+    release_resource(&descriptor);
+    if (number_of_frames < 0 || !load_resource(image_name, image))
+        return -1;
+    *key = hash_bytes(image->data, image->size, *key);
+    return number_of_frames;
+}
+
+bool load_sprite_sheet(const char *descriptor_name)
+{
+    int64_t start = now_ns();
+    SheetFrame frames[MAX_SPRITES];
+    Resource image;
+    uint64_t key;
+    int number_of_frames = read_sprite_sheet(descriptor_name, frames, &image, &key);
+    if (number_of_frames < 0)
+        return false;
+
+    char cache_name[64];
+    snprintf(cache_name, sizeof(cache_name), "sprites-%016llx.bin", (unsigned long long)key);
+    size_t cached_size;
+    uint8_t *cached = read_cache_file(cache_name, &cached_size);
+    bool ok;
+    const char *source;
+    if (cached && cached_sheet_matches(cached, cached_size, key, frames, number_of_frames)) {
+        ok     = register_sheet_sprites(cached + sizeof(SpriteCacheHeader), number_of_frames);
+        source = "cache";
+    } else {
+        size_t size;
+        uint8_t *converted = convert_sprite_sheet(&image, frames, number_of_frames, &size);
+        ok                 = converted && register_sheet_sprites(converted, number_of_frames);
+        if (ok) {
+            SpriteCacheHeader header = { SPRITE_CACHE_MAGIC, SPRITE_CACHE_VERSION, key, number_of_frames, (uint32_t)size };
+            write_cache_file(cache_name, &header, sizeof(header), converted, size);
+        }
+        memory_free(converted);
+        source = "decoded image";
+    }
+    memory_free(cached);
+    release_resource(&image);
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not load sprite sheet %s\n", descriptor_name);
+        return false;
+    }
+    printf("INFO : Loaded %d sprites from %s (%s) in %.2f ms\n", number_of_frames, descriptor_name, source, (now_ns() - start) / 1e6);
+    return true;
+}
+
+// Copies the new pixels into the sprites that are already registered, so
+// every object keeps pointing at the same Sprite. Nothing may draw while this
+// runs. Objects size their collisions by their sprite, so a frame whose size
+// changed is skipped until the next start.
+bool reload_sprite_sheet(const char *descriptor_name)
+{
+    int64_t start = now_ns();
+    SheetFrame frames[MAX_SPRITES];
+    Resource image;
+    uint64_t key;
+    int number_of_frames = read_sprite_sheet(descriptor_name, frames, &image, &key);
+    if (number_of_frames < 0)
+        return false;
+    size_t size;
+    uint8_t *converted = convert_sprite_sheet(&image, frames, number_of_frames, &size);
+    release_resource(&image);
+    if (!converted)
+        return false;
+    const uint8_t *mask = converted + number_of_frames * sizeof(SheetFrame);
+    size_t updated      = 0;
+    for (int i = 0; i < number_of_frames; i++) {
+        Sprite *sprite = lookup_sprite(frames[i].name);
+        if (!sprite)
+            fprintf(stderr, "ERROR: New sprite %s needs a restart\n", frames[i].name);
+        else if (sprite->width != frames[i].width || sprite->height != frames[i].height)
+            fprintf(stderr, "ERROR: Sprite %s changed its size, that needs a restart\n", frames[i].name);
+        else {
+            memcpy(sprite->data, mask, frames[i].width * frames[i].height);
+            updated++;
+        }
+        mask += frames[i].width * frames[i].height;
+    }
+    memory_free(converted);
+    printf("INFO : Reloaded %zu sprites from %s in %.2f ms\n", updated, descriptor_name, (now_ns() - start) / 1e6);
+    return true;
+}
+
+// at exit, after the render thread is gone
+void free_sprite_sheet()
+{
+    for (size_t i = 0; i < NUMBER_OF_NAMED_SPRITES; i++)
+        memory_free((char *)NAMED_SPRITES[i].name);
+    NUMBER_OF_NAMED_SPRITES = 0;
+    free_sprites();
+}
+
+//==========Entity==========//
+// Objects are referred to by handles instead of pointers. A handle names a
+// slot of the entity table and the generation the slot had when the object
+// was created. Destroying the object bumps the generation, so an old handle
+// resolves to NULL instead of to freed or reused memory.
+typedef struct {
+    uint32_t index;
+    uint32_t generation; // never 0, so a zeroed handle is no entity
+} EntityHandle;
+
+#define NO_ENTITY ((EntityHandle){ 0, 0 })
+
+//==========Animation==========//
+typedef struct
+{
+    bool loop;
+    Sprite **frames;
+    size_t number_of_frames;
+    double frame_duration;
+    size_t current_frame;
+    EntityHandle owner; // gets the current frame as its sprite
+    TimerId timer;      // shows the next frame
+} Anim;
+
+//==========Object==========//
+typedef struct {
+    Sprite *curr_sprite;
+    Fixed x, y;
+    Fixed init_x, init_y;
+    uint32_t color;
+    uint32_t points; // score for destroying it
+    Anim **animations;
+    size_t number_of_animations;
+} Object;
+
+#define pixels(col, row) pixels[((col) * (WINDOW_WIDTH)) + (row)]
+
+// draws only the part of the sprite that falls in cols [first_col, end_col) so
+// that several threads can rasterize disjoint bands of the same frame
+void draw_sprite_clipped(uint32_t *pixels, const Sprite *sprite, Fixed x, Fixed y, uint32_t color, size_t first_col, size_t end_col)
+{
+    const size_t left_up_x = fixed_to_int(x) - (int32_t)(sprite->width / 2);
+    const size_t left_up_y = fixed_to_int(y) - (int32_t)(sprite->height / 2);
+    for (size_t ys = 0; ys < sprite->height; ys++) {
+        size_t col = (ys + left_up_y);
+        if ((col < first_col) | (col >= end_col))
+            continue;
+        for (size_t xs = 0; xs < sprite->width; xs++) {
+            size_t row = xs + left_up_x;
+            if ((row < WINDOW_WIDTH) & (sprite->data[xs + ((sprite->height - ys - 1) * (sprite->width))]))
+                pixels(col, row) = color;
+        }
+    }
+}
+
+//==========Entity Table==========//
+// The objects themselves are packed at the front of one array. Destroying one
+// moves the last object into the hole and the slots keep track of where every
+// object went, so loops over objects stay dense and handles survive the move.
+// A pointer from entity_get is only good until the next entity_destroy.
+// Create and destroy on the main thread, entity_get is fine from parallel
+// jobs as long as nothing is created or destroyed meanwhile.
+#define MAX_ENTITIES 1024
+
+typedef struct {
+    Object objects[MAX_ENTITIES];
+    uint32_t owner[MAX_ENTITIES];      // slot of every object
+    uint32_t location[MAX_ENTITIES];   // object of every slot
+    uint32_t generation[MAX_ENTITIES]; // of every slot
+    uint32_t free_slots[MAX_ENTITIES];
+    size_t number_of_free_slots;
+    size_t number_of_entities;
+} EntityTable;
+
+static EntityTable ENTITIES;
+
+void init_entity_table(EntityTable *table)
+{
+    table->number_of_entities   = 0;
+    table->number_of_free_slots = MAX_ENTITIES;
+    for (uint32_t i = 0; i < MAX_ENTITIES; i++) {
+        table->generation[i] = 1;
+        table->free_slots[i] = MAX_ENTITIES - 1 - i; // low slots go first
+    }
+}
+
+// the new object is zeroed, object is NULL when the table is full
+EntityHandle entity_create(EntityTable *table, Object **object)
+{
+    if (table->number_of_free_slots == 0) {
+        fprintf(stderr, "ERROR: Could not create more than %d entities\n", MAX_ENTITIES);
+        *object = NULL;
+        return NO_ENTITY;
+    }
+    uint32_t slot         = table->free_slots[--table->number_of_free_slots];
+    uint32_t dense        = table->number_of_entities++;
+    table->location[slot] = dense;
+    table->owner[dense]   = slot;
+    table->objects[dense] = (Object){ 0 };
+    *object               = &table->objects[dense];
+    return (EntityHandle){ slot, table->generation[slot] };
+}
+
+// NULL once the object is destroyed
+static inline Object *entity_get(EntityTable *table, EntityHandle handle)
+{
+    if (handle.index >= MAX_ENTITIES || table->generation[handle.index] != handle.generation)
+        return NULL;
+    return &table->objects[table->location[handle.index]];
+}
+
+// the sprite is shared, it stays in SPRITES. Stale handles are ignored.
+bool entity_destroy(EntityTable *table, EntityHandle handle)
+{
+    if (!entity_get(table, handle))
+        return false;
+    uint32_t slot                        = handle.index;
+    uint32_t dense                       = table->location[slot];
+    uint32_t last                        = --table->number_of_entities;
+    table->objects[dense]                = table->objects[last];
+    table->owner[dense]                  = table->owner[last];
+    table->location[table->owner[dense]] = dense;
+    if (++table->generation[slot] == 0)
+        table->generation[slot] = 1;
+    table->free_slots[table->number_of_free_slots++] = slot;
+    return true;
+}
+
+#define NO_COLLISION ((size_t)-1)
+
+// returns the index of the first fire that hits the object or NO_COLLISION.
+// It does not modify anything so it is safe to call it from several jobs at once.
+size_t find_collision(Object *obj, const EntityHandle *fires, size_t first_fire, size_t number_of_fires)
+{
+    int32_t obj_x    = fixed_to_int(obj->x);
+    int32_t obj_y    = fixed_to_int(obj->y);
+    size_t up_obj    = obj_y + (int32_t)(obj->curr_sprite->height / 2);
+    size_t down_obj  = obj_y - (int32_t)(obj->curr_sprite->height / 2);
+    size_t right_obj = obj_x + (int32_t)(obj->curr_sprite->width / 2);
+    size_t left_obj  = obj_x - (int32_t)(obj->curr_sprite->width / 2);
+    for (size_t i = first_fire; i < number_of_fires; i++) {
+        Object *fire = entity_get(&ENTITIES, fires[i]);
+        if (fire == NULL)
+            continue;
+        int32_t fire_x    = fixed_to_int(fire->x);
+        int32_t fire_y    = fixed_to_int(fire->y);
+        size_t up_fire    = fire_y + (int32_t)(fire->curr_sprite->height / 2);
+        size_t down_fire  = fire_y - (int32_t)(fire->curr_sprite->height / 2);
+        size_t left_fire  = fire_x - (int32_t)(fire->curr_sprite->width / 2);
+        size_t right_fire = fire_x + (int32_t)(fire->curr_sprite->width / 2);
+
+        // TODO: also check curr_sprite data
+        if (((up_fire < up_obj && up_fire > down_obj) || (down_fire < up_obj && down_fire > down_obj)) && ((left_fire > right_obj && left_fire < left_obj) || (right_fire < right_obj && right_fire > left_obj)))
+            return i;
+    }
+    return NO_COLLISION;
+}
+
+//==========Animation Timers==========//
+static void next_animation_frame(void *data)
+{
+    Anim *anim  = data;
+    anim->timer = 0;
+    if (anim->current_frame + 1 < anim->number_of_frames)
+        anim->current_frame++;
+    else if (anim->loop)
+        anim->current_frame = 0;
+    else
+        return;
+    Object *owner = entity_get(&ENTITIES, anim->owner);
+    if (!owner)
+        return;
+    owner->curr_sprite = anim->frames[anim->current_frame];
+    anim->timer        = timer_schedule(&TIMERS, seconds_to_ticks(anim->frame_duration), next_animation_frame, anim);
+}
+
+void play_animation(Anim *anim, EntityHandle owner)
+{
+    Object *object      = entity_get(&ENTITIES, owner);
+    anim->current_frame = 0;
+    anim->owner         = owner;
+    if (object)
+        object->curr_sprite = anim->frames[0];
+    timer_cancel(&TIMERS, anim->timer);
+    anim->timer = timer_schedule(&TIMERS, seconds_to_ticks(anim->frame_duration), next_animation_frame, anim);
+}
+
+void stop_animation(Anim *anim)
+{
+    timer_cancel(&TIMERS, anim->timer);
+    anim->timer = 0;
+}
+
+//==========Events==========//
+// Systems append events while a tick runs and nobody reacts on the spot.
+// The main loop dispatches them at fixed sync points, one batch per type in
+// the order of EventType, so a handler gets all events of its type in one
+// array. Events that handlers emit are dispatched in the same sync point.
+// Emitting is safe from parallel jobs, dispatching is for the main thread.
+#define MAX_EVENTS_PER_TYPE 256
+#define MAX_EVENT_HANDLERS  8
+#define MAX_EVENT_ROUNDS    4 // handlers emitting events for handlers emitting events...
+
+typedef enum {
+    EVENT_HIT,        // a player fire hit object, other is the fire
+    EVENT_DEATH,      // an object was destroyed at x, y, value is its points
+    EVENT_DESPAWN,    // object left the playing field
+    EVENT_SPAWN,      // object entered the game
+    EVENT_FIRE,       // object fired, value is 1 for the player
+    EVENT_WAVE_CLEAR, // value is the number of the wave that was cleared
+    NUMBER_OF_EVENT_TYPES,
+} EventType;
+
+typedef struct {
+    uint64_t tick;
+    EntityHandle object; // may be stale by the time of dispatch
+    EntityHandle other;
+    float x, y;
+    uint32_t color;
+    uint32_t value;
+} GameEvent;
+
+typedef void (*EventHandler)(const GameEvent *events, size_t count, void *data);
+
+typedef struct {
+    GameEvent events[NUMBER_OF_EVENT_TYPES][MAX_EVENTS_PER_TYPE];
+    atomic_size_t count[NUMBER_OF_EVENT_TYPES];
+    EventHandler handlers[NUMBER_OF_EVENT_TYPES][MAX_EVENT_HANDLERS];
+    void *handler_data[NUMBER_OF_EVENT_TYPES][MAX_EVENT_HANDLERS];
+    size_t number_of_handlers[NUMBER_OF_EVENT_TYPES];
+    uint64_t tick;
+    size_t dispatched[NUMBER_OF_EVENT_TYPES];
+    atomic_size_t dropped;
+} EventBus;
+
+static EventBus EVENTS;
+static const char *EVENT_NAMES[NUMBER_OF_EVENT_TYPES] = { "hit", "death", "despawn", "spawn", "fire", "wave clear" };
+
+bool event_subscribe(EventBus *bus, EventType type, EventHandler handler, void *data)
+{
+    if (bus->number_of_handlers[type] >= MAX_EVENT_HANDLERS) {
+        fprintf(stderr, "ERROR: Could not add more than %d handlers for %s events\n", MAX_EVENT_HANDLERS, EVENT_NAMES[type]);
+        return false;
+    }
+    size_t i                   = bus->number_of_handlers[type]++;
+    bus->handlers[type][i]     = handler;
+    bus->handler_data[type][i] = data;
+    return true;
+}
+
+bool event_emit(EventBus *bus, EventType type, GameEvent event)
+{
+    size_t i = atomic_fetch_add_explicit(&bus->count[type], 1, memory_order_relaxed);
+    if (i >= MAX_EVENTS_PER_TYPE) {
+        atomic_fetch_add_explicit(&bus->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    event.tick           = bus->tick;
+    bus->events[type][i] = event;
+    return true;
+}
+
+static inline GameEvent object_event(EntityHandle handle)
+{
+    Object *object = entity_get(&ENTITIES, handle);
+    return (GameEvent){ .object = handle, .x = fixed_to_float(object->x), .y = fixed_to_float(object->y), .color = object->color };
+}
+
+// the jobs of the tick have to be finished. Batches are copied to FRAME_ARENA.
+void dispatch_events(EventBus *bus)
+{
+    for (size_t round = 0; round < MAX_EVENT_ROUNDS; round++) {
+        bool any = false;
+        for (size_t type = 0; type < NUMBER_OF_EVENT_TYPES; type++) {
+            size_t count = atomic_exchange_explicit(&bus->count[type], 0, memory_order_relaxed);
+            if (count > MAX_EVENTS_PER_TYPE)
+                count = MAX_EVENTS_PER_TYPE;
+            if (count == 0)
+                continue;
+            // handlers may emit more of the same type while we go through the batch
+            GameEvent *batch = arena_alloc(&FRAME_ARENA, count * sizeof(GameEvent));
+            if (!batch) {
+                atomic_fetch_add_explicit(&bus->dropped, count, memory_order_relaxed);
+                continue;
+            }
+            memcpy(batch, bus->events[type], count * sizeof(GameEvent));
+            for (size_t i = 0; i < bus->number_of_handlers[type]; i++)
+                bus->handlers[type][i](batch, count, bus->handler_data[type][i]);
+            bus->dispatched[type] += count;
+            any = true;
+        }
+        if (!any)
+            return;
+    }
+    fprintf(stderr, "ERROR: Events were still coming after %d rounds of dispatching\n", MAX_EVENT_ROUNDS);
+}
+
+void print_event_counts(EventBus *bus)
+{
+    printf("INFO : Events:");
+    for (size_t type = 0; type < NUMBER_OF_EVENT_TYPES; type++)
+        printf(" %s %zu%s", EVENT_NAMES[type], bus->dispatched[type], type + 1 < NUMBER_OF_EVENT_TYPES ? "," : "\n");
+    if (atomic_load(&bus->dropped))
+        fprintf(stderr, "ERROR: %zu events were dropped\n", atomic_load(&bus->dropped));
+}
+
+//==========Player==========//
+// There is a second player only in netplay, see the Netplay section.
+#define MAX_PLAYERS 2
+
+static Object PLAYERS[MAX_PLAYERS];
+static size_t NUMBER_OF_PLAYERS = 1;
+
+static const uint32_t PLAYER_COLORS[MAX_PLAYERS] = { 0xFFFFFFFF, 0xF5D547FF };
+
+// the players stand evenly spread over the bottom of the screen
+void init_player_objects(size_t number_of_players)
+{
+    NUMBER_OF_PLAYERS = number_of_players;
+    for (size_t i = 0; i < number_of_players; i++) {
+        Object *player      = &PLAYERS[i];
+        player->curr_sprite = find_sprite("player");
+        player->x = player->init_x = int_to_fixed((int32_t)(WINDOW_WIDTH * (i + 1) / (number_of_players + 1)));
+        player->y = player->init_y = int_to_fixed(WINDOW_HEIGHT / 5);
+        player->color                = PLAYER_COLORS[i];
+        player->animations           = NULL;
+        player->number_of_animations = 0;
+    }
+}
+
+//==========Input==========//
+// GLFW key callbacks push timestamped events into a single producer single
+// consumer ring and the simulation drains it once per tick. A tap that starts
+// and ends between two ticks still counts. The simulation itself only sees
+// whole ticks: the players' buttons are a mask per tick, which is what
+// replays and netplay send, and the fire rate is a timer on the wheel.
+// GLFW only delivers events from glfwPollEvents, so the timestamp is when the
+// poll saw the event.
+#define INPUT_RING_SIZE 256 // must be a power of two
+
+typedef enum {
+    INPUT_LEFT,
+    INPUT_RIGHT,
+    INPUT_FIRE,
+    INPUT_PAUSE,
+    INPUT_SLOWER,
+    INPUT_FASTER,
+    INPUT_REWIND,
+    INPUT_LEFT_2, // the second player of --netplay loopback
+    INPUT_RIGHT_2,
+    INPUT_FIRE_2,
+    NUMBER_OF_INPUT_ACTIONS,
+} InputAction;
+
+typedef struct {
+    int64_t time;
+    uint8_t action;
+    bool pressed;
+} InputEvent;
+
+typedef struct {
+    InputEvent events[INPUT_RING_SIZE];
+    atomic_size_t head; // next slot to write, only moved by the producer
+    atomic_size_t tail; // next slot to read, only moved by the consumer
+    atomic_size_t dropped;
+} InputRing;
+
+static InputRing INPUT_RING;
+
+// newest key state for code that cannot wait for the next tick (late latching)
+static atomic_bool KEY_DOWN[NUMBER_OF_INPUT_ACTIONS];
+static atomic_llong LAST_KEY_EVENT_TIME;
+
+bool input_ring_push(InputRing *ring, InputEvent event)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= INPUT_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return false;
+    }
+    ring->events[head & (INPUT_RING_SIZE - 1)] = event;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+bool input_ring_pop(InputRing *ring, InputEvent *event)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head)
+        return false;
+    *event = ring->events[tail & (INPUT_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_REPEAT)
+        return;
+    InputEvent event = { .time = now_ns(), .pressed = action == GLFW_PRESS };
+    switch (key) {
+    case GLFW_KEY_A: event.action = INPUT_LEFT; break;
+    case GLFW_KEY_D: event.action = INPUT_RIGHT; break;
+    case GLFW_KEY_SPACE: event.action = INPUT_FIRE; break;
+    case GLFW_KEY_P: event.action = INPUT_PAUSE; break;
+    case GLFW_KEY_LEFT_BRACKET: event.action = INPUT_SLOWER; break;
+    case GLFW_KEY_RIGHT_BRACKET: event.action = INPUT_FASTER; break;
+    case GLFW_KEY_R: event.action = INPUT_REWIND; break;
+    case GLFW_KEY_LEFT: event.action = INPUT_LEFT_2; break;
+    case GLFW_KEY_RIGHT: event.action = INPUT_RIGHT_2; break;
+    case GLFW_KEY_ENTER: event.action = INPUT_FIRE_2; break;
+    default: return;
+    }
+    atomic_store(&KEY_DOWN[event.action], event.pressed);
+    atomic_store(&LAST_KEY_EVENT_TIME, event.time);
+    input_ring_push(&INPUT_RING, event);
+}
+
+// what the simulation sees of the input during one tick
+typedef struct {
+    bool held[NUMBER_OF_INPUT_ACTIONS]; // down at the end of the tick
+    bool down[NUMBER_OF_INPUT_ACTIONS]; // down at any moment of the tick
+    size_t number_of_presses[NUMBER_OF_INPUT_ACTIONS];
+} InputState;
+
+// drains the ring into state and returns the time of the first event or 0.
+// Every event is also written to record, if there is one, as
+// "tick action pressed offset" where offset is the time of the event relative
+// to tick_time in ns.
+int64_t consume_input(InputRing *ring, InputState *state, uint64_t tick, int64_t tick_time, FILE *record)
+{
+    int64_t first_event_time = 0;
+    for (size_t i = 0; i < NUMBER_OF_INPUT_ACTIONS; i++) {
+        state->down[i]              = state->held[i];
+        state->number_of_presses[i] = 0;
+    }
+    InputEvent event;
+    while (input_ring_pop(ring, &event)) {
+        if (!first_event_time)
+            first_event_time = event.time;
+        state->held[event.action] = event.pressed;
+        if (event.pressed) {
+            state->down[event.action] = true;
+            state->number_of_presses[event.action]++;
+        }
+        if (record)
+            fprintf(record, "%" PRIu64 " %d %d %" PRId64 "\n", tick, event.action, event.pressed, event.time - tick_time);
+    }
+    return first_event_time;
+}
+
+//==========Player Action==========//
+#define MAX_PLAYER_FIRES 20
+EntityHandle player_fires[MAX_PLAYER_FIRES]; // a stale handle is a free slot
+
+#define MAX_ENEMY_FIRES 50
+EntityHandle enemy_fires[MAX_ENEMY_FIRES];
+
+static Sprite *FIRE_SPRITE;
+
+void initialize_fires()
+{
+    for (int i = 0; i < MAX_PLAYER_FIRES; i++)
+        player_fires[i] = NO_ENTITY;
+    for (int i = 0; i < MAX_ENEMY_FIRES; i++)
+        enemy_fires[i] = NO_ENTITY;
+    FIRE_SPRITE = find_sprite("fire");
+}
+
+#define PLAYER_FIRE_SPEED  FIXED(0.3)
+#define PLAYER_ENEMY_SPEED FIXED(0.1)
+
+// runs in a job, so fires that leave the screen are destroyed when their
+// despawn events are dispatched
+void moving_fires()
+{
+    for (int i = 0; i < MAX_PLAYER_FIRES; i++) {
+        Object *fire = entity_get(&ENTITIES, player_fires[i]);
+        if (fire != NULL) {
+            fire->y += PLAYER_FIRE_SPEED;
+            if (fire->y >= int_to_fixed(WINDOW_HEIGHT))
+                event_emit(&EVENTS, EVENT_DESPAWN, (GameEvent){ .object = player_fires[i] });
+        }
+    }
+    for (int i = 0; i < MAX_ENEMY_FIRES; i++) {
+        Object *fire = entity_get(&ENTITIES, enemy_fires[i]);
+        if (fire != NULL) {
+            fire->y -= PLAYER_ENEMY_SPEED;
+            if (fire->y <= 0)
+                event_emit(&EVENTS, EVENT_DESPAWN, (GameEvent){ .object = enemy_fires[i] });
+        }
+    }
+}
+
+void spawn_player_fire(Object *player)
+{
+    for (size_t i = 0; i < MAX_PLAYER_FIRES; i++) {
+        if (entity_get(&ENTITIES, player_fires[i]) == NULL) {
+            Object *fire;
+            player_fires[i] = entity_create(&ENTITIES, &fire);
+            if (!fire)
+                return;
+            fire->curr_sprite = FIRE_SPRITE;
+            fire->x           = player->x;
+            fire->y           = player->y;
+            fire->color       = player->color;
+            GameEvent event   = object_event(player_fires[i]);
+            event.value       = 1;
+            event_emit(&EVENTS, EVENT_FIRE, event);
+            return;
+        }
+    }
+    fprintf(stderr, "ERROR: Could not spawn a new fire anymore\n");
+}
+
+#define PLAYER_SPEED          FIXED(0.2)
+#define PLAYER_FIRE_RATE_TIME 0.4f
+
+// What a player did during one tick, that is all the simulation knows about
+// input. Netplay sends these to the other peers.
+typedef enum {
+    BUTTON_LEFT  = 1 << 0,
+    BUTTON_RIGHT = 1 << 1,
+    BUTTON_FIRE  = 1 << 2, // a press during the tick or held at its end
+} PlayerButton;
+
+uint8_t player_buttons(InputState *input, InputAction left, InputAction right, InputAction fire)
+{
+    uint8_t buttons = 0;
+    if (input->down[left])
+        buttons |= BUTTON_LEFT;
+    if (input->down[right])
+        buttons |= BUTTON_RIGHT;
+    if (input->number_of_presses[fire] || input->held[fire])
+        buttons |= BUTTON_FIRE;
+    return buttons;
+}
+
+// cleared by a shot, a timer sets it again after PLAYER_FIRE_RATE_TIME
+static bool PLAYER_FIRE_READY[MAX_PLAYERS] = { true, true };
+
+static void player_fire_ready(void *data)
+{
+    *(bool *)data = true;
+}
+
+void check_player_action(size_t index, uint8_t buttons)
+{
+    Object *player = &PLAYERS[index];
+    if (buttons & BUTTON_RIGHT) {
+        if (player->x + PLAYER_SPEED < int_to_fixed(WINDOW_WIDTH))
+            player->x += PLAYER_SPEED;
+    }
+    if (buttons & BUTTON_LEFT) {
+        if (player->x - PLAYER_SPEED >= 0)
+            player->x -= PLAYER_SPEED;
+    }
+    // a press shoots if the weapon is ready, holding the button shoots
+    // again the tick it gets ready, so the rate is exact
+    if (PLAYER_FIRE_READY[index] && (buttons & BUTTON_FIRE)) {
+        spawn_player_fire(player);
+        PLAYER_FIRE_READY[index] = false;
+        timer_schedule(&TIMERS, seconds_to_ticks(PLAYER_FIRE_RATE_TIME), player_fire_ready, &PLAYER_FIRE_READY[index]);
+    }
+}
+
+// P pauses, [ and ] halve and double the time scale
+void check_time_controls(InputState *input, FrameClock *clock)
+{
+    if (input->number_of_presses[INPUT_PAUSE] % 2)
+        set_paused(clock, !clock->paused);
+    for (size_t i = 0; i < input->number_of_presses[INPUT_SLOWER]; i++)
+        set_time_scale(clock, clock->scale / 2);
+    for (size_t i = 0; i < input->number_of_presses[INPUT_FASTER]; i++)
+        set_time_scale(clock, clock->scale * 2);
+}
+
+//==========Enemy==========//
+// every row fires at random moments, on average once per ENEMY_FIRE_MEAN_TICKS
+#define ENEMY_FIRE_MEAN_TICKS 10000
+
+typedef struct {
+    EntityHandle *enemies;
+    size_t number_of_enemies;
+    void (*spawn)(EntityHandle *enemies); // fills the row for a new wave
+} EnemyRow;
+
+// xorshift64*, the game has its own generator so that it is part of a save state
+static uint64_t RANDOM_STATE = 0x9E3779B97F4A7C15;
+
+static inline uint32_t game_random()
+{
+    RANDOM_STATE ^= RANDOM_STATE >> 12;
+    RANDOM_STATE ^= RANDOM_STATE << 25;
+    RANDOM_STATE ^= RANDOM_STATE >> 27;
+    return (uint32_t)((RANDOM_STATE * 0x2545F4914F6CDD1D) >> 32);
+}
+
+void spawn_enemy_fire(EntityHandle *enemies, size_t number_of_emmies)
+{
+    // a dead row keeps its timer until the next wave, it just has nobody to fire
+    size_t *live          = arena_alloc(&FRAME_ARENA, number_of_emmies * sizeof(size_t));
+    size_t number_of_live = 0;
+    if (!live)
+        return;
+    for (size_t i = 0; i < number_of_emmies; i++) {
+        if (entity_get(&ENTITIES, enemies[i]) != NULL)
+            live[number_of_live++] = i;
+    }
+    if (number_of_live == 0)
+        return;
+
+    Object *enemy = entity_get(&ENTITIES, enemies[live[game_random() % number_of_live]]);
+
+    for (size_t i = 0; i < MAX_ENEMY_FIRES; i++) {
+        if (entity_get(&ENTITIES, enemy_fires[i]) == NULL) {
+            Object *fire;
+            enemy_fires[i] = entity_create(&ENTITIES, &fire);
+            if (!fire)
+                return;
+            fire->curr_sprite = FIRE_SPRITE;
+            fire->x           = enemy->x;
+            fire->y           = enemy->y;
+            fire->color       = enemy->color;
+            event_emit(&EVENTS, EVENT_FIRE, object_event(enemy_fires[i]));
+            return;
+        }
+    }
+    fprintf(stderr, "ERROR: Could not spawn a new fire anymore\n");
+}
+
+// the time between two fires is exponentially distributed, as if every tick
+// had a 1 in ENEMY_FIRE_MEAN_TICKS chance
+static uint64_t random_enemy_fire_delay()
+{
+    double u = (game_random() + 1.0) / ((double)UINT32_MAX + 2.0);
+    return 1 + (uint64_t)(log(u) / log1p(-1.0 / ENEMY_FIRE_MEAN_TICKS));
+}
+
+static void enemy_fire_timer(void *data)
+{
+    EnemyRow *row = data;
+    spawn_enemy_fire(row->enemies, row->number_of_enemies);
+    timer_schedule(&TIMERS, random_enemy_fire_delay(), enemy_fire_timer, row);
+}
+
+void start_enemy_fire(EnemyRow *row)
+{
+    timer_schedule(&TIMERS, random_enemy_fire_delay(), enemy_fire_timer, row);
+}
+
+#define ENEMY_SPEED          2 // radians per second
+#define ENEMY_ANGLE_PER_TICK ((Angle)(ENEMY_SPEED * ANGLE_TURN / (2 * M_PI * SIMULATION_RATE) + 0.5))
+
+// Everything an enemy owns besides its entity comes from here. A wave only
+// ends once all of its enemies are gone, then the arena is reset in one go.
+#define WAVE_ARENA_SIZE (64 * 1024)
+
+static Arena WAVE_ARENA;
+
+// a looping animation carved from WAVE_ARENA that starts playing on the enemy
+static bool give_enemy_animation(Object *enemy, EntityHandle handle, Sprite **sprites, size_t number_of_frames, double frame_duration)
+{
+    Anim **animations = arena_alloc(&WAVE_ARENA, sizeof(Anim *));
+    Anim *anim        = arena_alloc(&WAVE_ARENA, sizeof(Anim));
+    Sprite **frames   = arena_alloc(&WAVE_ARENA, number_of_frames * sizeof(Sprite *));
+    if (!animations || !anim || !frames)
+        return false;
+    memcpy(frames, sprites, number_of_frames * sizeof(Sprite *));
+    *anim = (Anim){
+        .loop             = true,
+        .frames           = frames,
+        .number_of_frames = number_of_frames,
+        .frame_duration   = frame_duration,
+    };
+    animations[0]               = anim;
+    enemy->animations           = animations;
+    enemy->number_of_animations = 1;
+    play_animation(anim, handle);
+    return true;
+}
+
+static inline void moving_enemy_animation(Object *enemy, uint64_t game_tick)
+{
+    enemy->x = enemy->init_x + fixed_sin((Angle)(game_tick * ENEMY_ANGLE_PER_TICK)) * (WINDOW_WIDTH / 16);
+}
+
+#define NUMBER_OF_GREEN_ENEMIES_IN_ROW 8
+#define GREEN_ENEMY_ANIMATION_FRAMES   2
+#define GREEN_ENEMY_FRAME_DURATION     0.2
+
+// fills every slot of the row with a new enemy
+void spawn_green_enemies(EntityHandle *enemies)
+{
+    Sprite *sprites[GREEN_ENEMY_ANIMATION_FRAMES];
+    for (size_t j = 0; j < GREEN_ENEMY_ANIMATION_FRAMES; j++) {
+        char name[SPRITE_NAME_LENGTH];
+        snprintf(name, sizeof(name), "green_enemy_%zu", j);
+        sprites[j] = find_sprite(name);
+    }
+    const size_t STRIDE = (WINDOW_WIDTH * 3 / 4) / NUMBER_OF_GREEN_ENEMIES_IN_ROW;
+    for (size_t i = 0; i < NUMBER_OF_GREEN_ENEMIES_IN_ROW; i++) {
+        Object *enemy;
+        enemies[i] = entity_create(&ENTITIES, &enemy);
+        if (!enemy)
+            continue;
+        enemy->x = enemy->init_x = int_to_fixed((i * STRIDE) + (WINDOW_WIDTH / 8) + (STRIDE / 2));
+        enemy->y = enemy->init_y = int_to_fixed(WINDOW_HEIGHT * 8 / 10);
+        enemy->color             = 0x31EDEEFF;
+        enemy->points            = 10;
+        if (!give_enemy_animation(enemy, enemies[i], sprites, GREEN_ENEMY_ANIMATION_FRAMES, GREEN_ENEMY_FRAME_DURATION)) {
+            entity_destroy(&ENTITIES, enemies[i]);
+            continue;
+        }
+        printf("INFO : A green enemy was created in position (%d, %d)\n", fixed_to_int(enemy->x), fixed_to_int(enemy->y));
+        event_emit(&EVENTS, EVENT_SPAWN, object_event(enemies[i]));
+    }
+}
+
+EntityHandle *create_green_enemies()
+{
+    EntityHandle *enemies = memory_alloc(MEMORY_ENEMIES, NUMBER_OF_GREEN_ENEMIES_IN_ROW * sizeof(EntityHandle));
+    if (!enemies) {
+        fprintf(stderr, "ERROR: Could not malloc memory for list of green enemies. Please buy more RAM!");
+        return NULL;
+    }
+    spawn_green_enemies(enemies);
+    return enemies;
+}
+
+#define NUMBER_OF_RED_ENEMIES_IN_ROW 8
+#define RED_ENEMY_ANIMATION_FRAMES   2
+#define RED_ENEMY_FRAME_DURATION     0.2
+
+// fills every slot of the row with a new enemy
+void spawn_red_enemies(EntityHandle *enemies)
+{
+    Sprite *sprites[RED_ENEMY_ANIMATION_FRAMES];
+    for (size_t j = 0; j < RED_ENEMY_ANIMATION_FRAMES; j++) {
+        char name[SPRITE_NAME_LENGTH];
+        snprintf(name, sizeof(name), "red_enemy_%zu", j);
+        sprites[j] = find_sprite(name);
+    }
+    const size_t STRIDE = (WINDOW_WIDTH * 3 / 4) / NUMBER_OF_RED_ENEMIES_IN_ROW;
+    for (size_t i = 0; i < NUMBER_OF_RED_ENEMIES_IN_ROW; i++) {
+        Object *enemy;
+        enemies[i] = entity_create(&ENTITIES, &enemy);
+        if (!enemy)
+            continue;
+        enemy->x = enemy->init_x = int_to_fixed((i * STRIDE) + (WINDOW_WIDTH / 8) + (STRIDE / 2));
+        enemy->y = enemy->init_y = int_to_fixed(WINDOW_HEIGHT * 7 / 10);
+        enemy->color             = 0xEB1A40FF;
+        enemy->points            = 20;
+        if (!give_enemy_animation(enemy, enemies[i], sprites, RED_ENEMY_ANIMATION_FRAMES, RED_ENEMY_FRAME_DURATION)) {
+            entity_destroy(&ENTITIES, enemies[i]);
+            continue;
+        }
+        printf("INFO : A red enemy was created in position (%d, %d)\n", fixed_to_int(enemy->x), fixed_to_int(enemy->y));
+        event_emit(&EVENTS, EVENT_SPAWN, object_event(enemies[i]));
+    }
+}
+
+EntityHandle *create_red_enemies()
+{
+    EntityHandle *enemies = memory_alloc(MEMORY_ENEMIES, NUMBER_OF_RED_ENEMIES_IN_ROW * sizeof(EntityHandle));
+    if (!enemies) {
+        fprintf(stderr, "ERROR: Could not malloc memory for list of red enemies. Please buy more RAM!");
+        return NULL;
+    }
+    spawn_red_enemies(enemies);
+    return enemies;
+}
+
+// stops the animations too, their timers point to the enemy's Anims. The
+// Anims stay in WAVE_ARENA until the wave is over.
+void delete_enemy(EntityHandle handle)
+{
+    Object *enemy = entity_get(&ENTITIES, handle);
+    if (!enemy)
+        return;
+    for (size_t i = 0; i < enemy->number_of_animations; i++)
+        stop_animation(enemy->animations[i]);
+    entity_destroy(&ENTITIES, handle);
+}
+
+void delete_enemies(EntityHandle *enemies, size_t number_of_enemies)
+{
+    for (size_t i = 0; i < number_of_enemies; i++)
+        delete_enemy(enemies[i]);
+    memory_free(enemies);
+}
+
+//==========Rules==========//
+// What the events mean for the game: hits destroy things, destroyed enemies
+// score and a cleared wave brings the next one.
+typedef struct {
+    EnemyRow *rows;
+    size_t number_of_rows;
+    uint64_t score;
+    uint32_t wave;
+} Rules;
+
+static void destroy_hit_objects(const GameEvent *events, size_t count, void *data)
+{
+    for (size_t i = 0; i < count; i++) {
+        Object *target = entity_get(&ENTITIES, events[i].object);
+        if (target == NULL || entity_get(&ENTITIES, events[i].other) == NULL)
+            continue;
+        GameEvent death = object_event(events[i].object);
+        death.value     = target->points;
+        entity_destroy(&ENTITIES, events[i].other);
+        delete_enemy(events[i].object);
+        event_emit(&EVENTS, EVENT_DEATH, death);
+    }
+}
+
+static void destroy_despawned_objects(const GameEvent *events, size_t count, void *data)
+{
+    for (size_t i = 0; i < count; i++)
+        entity_destroy(&ENTITIES, events[i].object);
+}
+
+static void score_deaths(const GameEvent *events, size_t count, void *data)
+{
+    Rules *rules = data;
+    for (size_t i = 0; i < count; i++)
+        rules->score += events[i].value;
+}
+
+static void check_wave_clear(const GameEvent *events, size_t count, void *data)
+{
+    Rules *rules = data;
+    for (size_t row = 0; row < rules->number_of_rows; row++)
+        for (size_t i = 0; i < rules->rows[row].number_of_enemies; i++)
+            if (entity_get(&ENTITIES, rules->rows[row].enemies[i]) != NULL)
+                return;
+    event_emit(&EVENTS, EVENT_WAVE_CLEAR, (GameEvent){ .value = rules->wave });
+}
+
+static void start_next_wave(const GameEvent *events, size_t count, void *data)
+{
+    Rules *rules = data;
+    printf("INFO : Wave %u cleared, score %" PRIu64 "\n", rules->wave, rules->score);
+    rules->wave++;
+    // nothing of the cleared wave is alive anymore
+    arena_reset(&WAVE_ARENA);
+    for (size_t row = 0; row < rules->number_of_rows; row++)
+        rules->rows[row].spawn(rules->rows[row].enemies);
+}
+
+void init_rules(Rules *rules, EnemyRow *rows, size_t number_of_rows)
+{
+    *rules = (Rules){ .rows = rows, .number_of_rows = number_of_rows, .wave = 1 };
+    event_subscribe(&EVENTS, EVENT_HIT, destroy_hit_objects, rules);
+    event_subscribe(&EVENTS, EVENT_DESPAWN, destroy_despawned_objects, rules);
+    event_subscribe(&EVENTS, EVENT_DEATH, score_deaths, rules);
+    event_subscribe(&EVENTS, EVENT_DEATH, check_wave_clear, rules);
+    event_subscribe(&EVENTS, EVENT_WAVE_CLEAR, start_next_wave, rules);
+}
+
+//==========Save State==========//
+// The whole simulation as one flat blob. transfer_game_state() lists every
+// piece once and does both saving and loading, so the two always agree on the
+// layout. Pointers are kept as they are: sprites, enemy rows and WAVE_ARENA
+// stay at their addresses for the whole run, so only the process that saved a
+// state can load it. The parts whose size changes come last, which keeps the
+// XOR deltas of the rewind buffer small.
+#define MAX_GAME_STATE_SIZE (sizeof(TimerWheel) + sizeof(EntityTable) + WAVE_ARENA_SIZE + 4096)
+
+typedef struct {
+    uint8_t *data;
+    size_t size; // bytes written or read so far
+    size_t capacity;
+    bool loading;
+    bool failed; // ran out of capacity or read something impossible
+} StateStream;
+
+static void state_bytes(StateStream *stream, void *data, size_t size)
+{
+    if (stream->failed || size > stream->capacity - stream->size) {
+        stream->failed = true;
+        return;
+    }
+    if (stream->loading)
+        memcpy(data, stream->data + stream->size, size);
+    else
+        memcpy(stream->data + stream->size, data, size);
+    stream->size += size;
+}
+
+#define state_value(stream, value) state_bytes(stream, &(value), sizeof(value))
+
+// A failed load leaves the game half loaded, only load states that were saved
+// by this process. Events of the tick have to be dispatched already.
+bool transfer_game_state(StateStream *stream, Rules *rules)
+{
+    uint32_t high_water = TIMERS.high_water;
+
+    state_value(stream, RANDOM_STATE);
+    state_value(stream, CLOCK.game_time);
+    state_value(stream, rules->score);
+    state_value(stream, rules->wave);
+    state_value(stream, PLAYERS);
+    state_value(stream, PLAYER_FIRE_READY);
+    state_value(stream, player_fires);
+    state_value(stream, enemy_fires);
+    for (size_t row = 0; row < rules->number_of_rows; row++)
+        state_bytes(stream, rules->rows[row].enemies, rules->rows[row].number_of_enemies * sizeof(EntityHandle));
+    state_value(stream, TIMERS.tick);
+    state_value(stream, TIMERS.free_list);
+    state_value(stream, TIMERS.number_of_timers);
+    state_value(stream, TIMERS.slots);
+    state_value(stream, ENTITIES.number_of_free_slots);
+    state_value(stream, ENTITIES.generation);
+    state_value(stream, ENTITIES.free_slots);
+
+    state_value(stream, TIMERS.high_water);
+    state_value(stream, WAVE_ARENA.used);
+    state_value(stream, ENTITIES.number_of_entities);
+    if (TIMERS.high_water > MAX_TIMERS || WAVE_ARENA.used > WAVE_ARENA.size || ENTITIES.number_of_entities > MAX_ENTITIES)
+        stream->failed = true;
+    if (stream->failed)
+        return false;
+    state_bytes(stream, TIMERS.timers, TIMERS.high_water * sizeof(Timer));
+    state_bytes(stream, WAVE_ARENA.base, WAVE_ARENA.used);
+    state_bytes(stream, ENTITIES.objects, ENTITIES.number_of_entities * sizeof(Object));
+    state_bytes(stream, ENTITIES.owner, ENTITIES.number_of_entities * sizeof(uint32_t));
+
+    if (stream->loading && !stream->failed) {
+        // timers past the saved high water go back to how init left them
+        for (uint32_t i = TIMERS.high_water; i < high_water; i++)
+            TIMERS.timers[i] = (Timer){ .next = i + 1 < MAX_TIMERS ? i + 1 : TIMER_NONE };
+        for (uint32_t i = 0; i < ENTITIES.number_of_entities; i++)
+            ENTITIES.location[ENTITIES.owner[i]] = i;
+    }
+    return !stream->failed;
+}
+
+size_t save_game_state(uint8_t *data, size_t capacity, Rules *rules)
+{
+    StateStream stream = { .data = data, .capacity = capacity };
+    if (!transfer_game_state(&stream, rules)) {
+        fprintf(stderr, "ERROR: The game state does not fit in %zu bytes\n", capacity);
+        return 0;
+    }
+    return stream.size;
+}
+
+bool load_game_state(uint8_t *data, size_t size, Rules *rules)
+{
+    StateStream stream = { .data = data, .capacity = size, .loading = true };
+    if (!transfer_game_state(&stream, rules)) {
+        fprintf(stderr, "ERROR: Could not load a game state of %zu bytes\n", size);
+        return false;
+    }
+    return true;
+}
+
+//==========Rewind==========//
+// Holding R plays the game backwards. Every simulated tick saves the state
+// but only keeps its XOR with the state before, run length encoded. Most of
+// the state does not change from one tick to the next, so a delta is a few
+// dozen bytes. Stepping back applies the newest delta to the current state,
+// which turns it into the state of the tick before. The deltas share a ring
+// of --rewind-budget bytes, the oldest are dropped to make room.
+// Bytes past the size of a state are kept zero in both state buffers, so a
+// delta is simply the XOR of the two buffers.
+#define REWIND_MAX_ENTRIES  (120 * SIMULATION_RATE) // two minutes at most
+#define REWIND_MIN_RUN      4 // equal bytes that end a run of changed ones
+
+typedef struct {
+    size_t offset, length; // of the encoded delta in the ring
+    size_t state_size;     // of the state the delta leads back to
+} RewindEntry;
+
+typedef struct {
+    uint8_t *ring;
+    size_t capacity;
+    size_t head; // where the next delta goes
+    RewindEntry *entries;
+    size_t first, count; // oldest entry and how many there are
+    uint8_t *current;    // state of the last recorded tick
+    uint8_t *next;
+    uint8_t *delta; // encoding scratch
+    size_t current_size, next_size;
+    uint64_t saves, restores;
+    int64_t save_time, restore_time; // ns
+} Rewind;
+
+static Rewind REWIND;
+
+static size_t put_varint(uint8_t *out, size_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    out[length++] = (uint8_t)value;
+    return length;
+}
+
+// 0 if the varint does not end before end
+static size_t get_varint(const uint8_t *in, const uint8_t *end, size_t *value)
+{
+    size_t length = 0;
+    *value        = 0;
+    do {
+        if (in + length == end || length == 10)
+            return 0;
+        *value |= (size_t)(in[length] & 0x7F) << (7 * length);
+    } while (in[length++] & 0x80);
+    return length;
+}
+
+static inline uint64_t load_word(const uint8_t *data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return word;
+}
+
+// pairs of (unchanged bytes, changed bytes) as varints, each followed by the
+// XOR of the changed bytes
+static size_t encode_delta(const uint8_t *a, const uint8_t *b, size_t length, uint8_t *out)
+{
+    size_t i = 0, size = 0;
+    while (i < length) {
+        size_t start = i;
+        while (i + sizeof(uint64_t) <= length && load_word(a + i) == load_word(b + i))
+            i += sizeof(uint64_t);
+        while (i < length && a[i] == b[i])
+            i++;
+        size_t unchanged = i - start;
+        if (i == length)
+            break;
+        start        = i;
+        size_t equal = 0;
+        for (; i < length; i++) {
+            if (a[i] != b[i])
+                equal = 0;
+            else if (++equal == REWIND_MIN_RUN)
+                break;
+        }
+        if (i < length)
+            i -= REWIND_MIN_RUN - 1;
+        size += put_varint(out + size, unchanged);
+        size += put_varint(out + size, i - start);
+        for (size_t j = start; j < i; j++)
+            out[size++] = a[j] ^ b[j];
+    }
+    return size;
+}
+
+// false if the delta is broken or reaches past size, deltas also come from the network
+static bool apply_delta(uint8_t *state, size_t size, const uint8_t *delta, size_t length)
+{
+    const uint8_t *end = delta + length;
+    size_t i = 0, read = 0;
+    while (read < length) {
+        size_t unchanged, changed;
+        size_t used = get_varint(delta + read, end, &unchanged);
+        if (used == 0)
+            return false;
+        read += used;
+        used = get_varint(delta + read, end, &changed);
+        if (used == 0)
+            return false;
+        read += used;
+        if (unchanged > size - i || changed > size - i - unchanged || changed > length - read)
+            return false;
+        i += unchanged;
+        for (size_t j = 0; j < changed; j++)
+            state[i++] ^= delta[read++];
+    }
+    return true;
+}
+
+// budget is in bytes, the current game state is the first one to go back to
+bool start_rewind(Rewind *rewind, size_t budget, Rules *rules)
+{
+    *rewind         = (Rewind){ .capacity = budget };
+    rewind->ring    = memory_alloc(MEMORY_REWIND, budget);
+    rewind->entries = memory_alloc(MEMORY_REWIND, REWIND_MAX_ENTRIES * sizeof(RewindEntry));
+    rewind->current = memory_calloc(MEMORY_REWIND, 1, MAX_GAME_STATE_SIZE);
+    rewind->next    = memory_calloc(MEMORY_REWIND, 1, MAX_GAME_STATE_SIZE);
+    // a delta is never more than twice the state, the varints included
+    rewind->delta = memory_alloc(MEMORY_REWIND, 2 * MAX_GAME_STATE_SIZE);
+    if (!rewind->ring || !rewind->entries || !rewind->current || !rewind->next || !rewind->delta) {
+        fprintf(stderr, "ERROR: Could not malloc memory for rewinding. Please buy more RAM!\n");
+        return false;
+    }
+    rewind->current_size = save_game_state(rewind->current, MAX_GAME_STATE_SIZE, rules);
+    return rewind->current_size > 0;
+}
+
+void stop_rewind(Rewind *rewind)
+{
+    if (rewind->saves) {
+        size_t bytes = 0;
+        for (size_t i = 0; i < rewind->count; i++)
+            bytes += rewind->entries[(rewind->first + i) % REWIND_MAX_ENTRIES].length;
+        printf("INFO : Rewind kept %zu ticks in %zu bytes, %.2f us per save, %.2f us per restore\n",
+               rewind->count, bytes, rewind->save_time / 1e3 / rewind->saves,
+               rewind->restores ? rewind->restore_time / 1e3 / rewind->restores : 0.0);
+    }
+    memory_free(rewind->ring);
+    memory_free(rewind->entries);
+    memory_free(rewind->current);
+    memory_free(rewind->next);
+    memory_free(rewind->delta);
+    *rewind = (Rewind){ 0 };
+}
+
+// Space for length bytes at the head, or wrapped to the start of the ring.
+// Whatever is in the way is the oldest, it is dropped.
+static size_t rewind_reserve(Rewind *rewind, size_t length)
+{
+    size_t offset = rewind->head + length <= rewind->capacity ? rewind->head : 0;
+    while (rewind->count) {
+        RewindEntry *oldest = &rewind->entries[rewind->first];
+        bool wrapped_over   = offset == 0 && rewind->head != 0 && oldest->offset >= rewind->head;
+        bool overlaps       = oldest->offset < offset + length && offset < oldest->offset + oldest->length;
+        if (!wrapped_over && !overlaps && rewind->count < REWIND_MAX_ENTRIES)
+            break;
+        rewind->first = (rewind->first + 1) % REWIND_MAX_ENTRIES;
+        rewind->count--;
+    }
+    rewind->head = offset + length;
+    return offset;
+}
+
+// call after the events of a simulated tick were dispatched
+void rewind_record(Rewind *rewind, Rules *rules)
+{
+    if (!rewind->ring)
+        return;
+    int64_t start = now_ns();
+    size_t size   = save_game_state(rewind->next, MAX_GAME_STATE_SIZE, rules);
+    if (size == 0)
+        return;
+    if (size < rewind->next_size)
+        memset(rewind->next + size, 0, rewind->next_size - size);
+    rewind->next_size = size;
+
+    size_t span   = size > rewind->current_size ? size : rewind->current_size;
+    size_t length = encode_delta(rewind->current, rewind->next, span, rewind->delta);
+    if (length <= rewind->capacity) {
+        size_t offset = rewind_reserve(rewind, length);
+        memcpy(rewind->ring + offset, rewind->delta, length);
+        rewind->entries[(rewind->first + rewind->count) % REWIND_MAX_ENTRIES] = (RewindEntry){ offset, length, rewind->current_size };
+        rewind->count++;
+    } else {
+        // too big to keep, the ticks before it can not be reached anymore
+        rewind->count = 0;
+        rewind->head  = 0;
+    }
+
+    uint8_t *previous    = rewind->current;
+    rewind->current      = rewind->next;
+    rewind->next         = previous;
+    rewind->next_size    = rewind->current_size;
+    rewind->current_size = size;
+    rewind->saves++;
+    rewind->save_time += now_ns() - start;
+}
+
+// goes back one tick, false once there is nothing left to go back to
+bool rewind_step(Rewind *rewind, Rules *rules)
+{
+    if (!rewind->ring || rewind->count == 0)
+        return false;
+    int64_t start        = now_ns();
+    RewindEntry *newest  = &rewind->entries[(rewind->first + rewind->count - 1) % REWIND_MAX_ENTRIES];
+    apply_delta(rewind->current, MAX_GAME_STATE_SIZE, rewind->ring + newest->offset, newest->length);
+    rewind->current_size = newest->state_size;
+    rewind->head         = newest->offset;
+    rewind->count--;
+    bool loaded = load_game_state(rewind->current, rewind->current_size, rules);
+    rewind->restores++;
+    rewind->restore_time += now_ns() - start;
+    return loaded;
+}
+
+//==========Frame Pacing==========//
+// Waiting is done in two steps: clock_nanosleep until shortly before the
+// deadline and then spinning on the clock. The spin margin follows how late
+// the sleeps actually wake up, so we only burn the CPU as long as we have to.
+#define PACING_MIN_SPIN_MARGIN 20000   // ns
+#define PACING_MAX_SPIN_MARGIN 2000000 // ns
+#define PACING_MAX_LAG         250000000 // ns, do not try to catch up after longer stalls
+#define PACING_REPORT_INTERVAL 5000000000 // ns
+
+typedef enum {
+    PACING_VSYNC,
+    PACING_CAPPED,
+    PACING_UNCAPPED,
+} PacingMode;
+
+static _Thread_local int64_t spin_margin = 200000;
+
+void precise_wait_until(int64_t deadline)
+{
+    int64_t sleep_until = deadline - spin_margin;
+    if (sleep_until > now_ns()) {
+        struct timespec until = { sleep_until / 1000000000, sleep_until % 1000000000 };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR)
+            ;
+        int64_t late = now_ns() - sleep_until;
+        // go up quickly after a late wake up, come down slowly
+        if (late > spin_margin)
+            spin_margin += (late - spin_margin) / 4;
+        else
+            spin_margin -= (spin_margin - late) / 64;
+    } else {
+        // the margin ate the whole wait, let it shrink or we never sleep again
+        spin_margin -= spin_margin / 64;
+    }
+    if (spin_margin < PACING_MIN_SPIN_MARGIN)
+        spin_margin = PACING_MIN_SPIN_MARGIN;
+    if (spin_margin > PACING_MAX_SPIN_MARGIN)
+        spin_margin = PACING_MAX_SPIN_MARGIN;
+    while (now_ns() < deadline)
+        ;
+}
+
+typedef struct {
+    uint64_t frames;
+    uint64_t late_frames;
+    double sum, sum_of_squares;
+    int64_t min, max;
+} FrameStats;
+
+typedef struct {
+    PacingMode mode;
+    int64_t interval; // ns between frames, also the budget for late frames
+    int64_t next_frame;
+    int64_t last_frame;
+    int64_t last_report;
+    bool print_reports;
+    FrameStats recent; // since the last report
+    FrameStats total;
+} FramePacer;
+
+static void reset_frame_stats(FrameStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->min = INT64_MAX;
+}
+
+static void add_frame_time(FrameStats *stats, int64_t frame_time, bool late)
+{
+    stats->frames++;
+    stats->late_frames += late;
+    stats->sum += frame_time;
+    stats->sum_of_squares += (double)frame_time * frame_time;
+    if (frame_time < stats->min)
+        stats->min = frame_time;
+    if (frame_time > stats->max)
+        stats->max = frame_time;
+}
+
+static void print_frame_stats(const char *title, FrameStats *stats)
+{
+    if (stats->frames == 0)
+        return;
+    double mean   = stats->sum / stats->frames;
+    double jitter = sqrt(fmax(0.0, stats->sum_of_squares / stats->frames - mean * mean));
+    printf("INFO : %s: %" PRIu64 " frames, %.3f ms mean, %.3f ms jitter, %.3f..%.3f ms, %" PRIu64 " late\n",
+           title, stats->frames, mean / 1e6, jitter / 1e6, stats->min / 1e6, stats->max / 1e6, stats->late_frames);
+}
+
+void init_frame_pacer(FramePacer *pacer, PacingMode mode, double fps, bool print_reports)
+{
+    pacer->mode          = mode;
+    pacer->interval      = fps > 0 ? (int64_t)(1e9 / fps) : 0;
+    pacer->print_reports = print_reports;
+    pacer->next_frame    = now_ns();
+    pacer->last_frame    = pacer->next_frame;
+    pacer->last_report   = pacer->next_frame;
+    reset_frame_stats(&pacer->recent);
+    reset_frame_stats(&pacer->total);
+}
+
+// blocks until the next frame is due, only capped mode waits here. With vsync
+// glfwSwapBuffers does the waiting.
+void pacer_wait(FramePacer *pacer)
+{
+    if (pacer->mode != PACING_CAPPED || pacer->interval == 0)
+        return;
+    pacer->next_frame += pacer->interval;
+    int64_t now = now_ns();
+    if (now - pacer->next_frame > PACING_MAX_LAG)
+        pacer->next_frame = now;
+    precise_wait_until(pacer->next_frame);
+}
+
+// call once per presented frame
+void pacer_frame_done(FramePacer *pacer)
+{
+    int64_t now        = now_ns();
+    int64_t frame_time = now - pacer->last_frame;
+    bool late          = pacer->interval && frame_time > pacer->interval + pacer->interval / 2;
+    pacer->last_frame  = now;
+    add_frame_time(&pacer->recent, frame_time, late);
+    add_frame_time(&pacer->total, frame_time, late);
+
+    if (now - pacer->last_report >= PACING_REPORT_INTERVAL) {
+        if (pacer->print_reports)
+            print_frame_stats("Frame pacing", &pacer->recent);
+        reset_frame_stats(&pacer->recent);
+        pacer->last_report = now;
+    }
+}
+
+//==========Config==========//
+#define MAX_REPLAYS 16
+
+typedef enum {
+    NETPLAY_OFF,
+    NETPLAY_LOOPBACK, // the second player is local, its buttons go through a loopback transport
+    NETPLAY_HOST,
+    NETPLAY_JOIN,
+} NetplayMode;
+
+typedef struct {
+    size_t job_threads; // 0 = one per core, 1 = deterministic single thread mode
+    PacingMode pacing;
+    double fps_cap;      // used by PACING_CAPPED
+    double time_scale;   // game speed at startup, 1 = normal
+    double refresh_rate; // of the monitor, filled in by main for the statistics
+    bool frame_stats;
+    const char *record_input; // file to write every input event to
+    bool late_latch;          // move the player again right before the upload
+    const char *cache_dir;
+    const char *resource_dir; // load resources from here instead of the packed ones
+    const char *asset_pack;   // map this pack instead of the embedded one
+    bool verify_assets;       // check asset hashes when they are loaded
+    bool hot_reload;          // reload changed shaders and sprites while running
+    bool track_memory;        // account every allocation and report leaks on exit
+    size_t rewind_budget;     // bytes for rewinding, 0 turns it off
+    NetplayMode netplay;
+    const char *net_address; // port to host on or host:port to join
+    double net_latency;      // ms added to every packet we send
+    double net_loss;         // share of the packets we send that are lost
+    const char *server_port;     // run headless for thin clients
+    const char *connect_address; // host:port of a server to be a thin client of
+    size_t bots;                 // run this many headless clients instead
+    const char *spectate;        // TCP port or Unix socket path to stream the framebuffer on
+    const char *capture;         // file to write every presented frame to
+    const char *replays[MAX_REPLAYS]; // input recordings to play without a window
+    size_t number_of_replays;
+    const char *golden;     // directory with the golden frames of the replay
+    bool update_golden;     // write the golden frames instead of checking them
+    const char *perf_check; // baseline to compare the stage timings of the replays with
+    size_t perf_runs;       // of every replay, the fastest counts
+    double perf_tolerance;  // percent a stage may get slower
+    bool update_baseline;   // write the baseline instead of checking it
+} Config;
+
+static Config CONFIG = {
+    .job_threads   = 0,
+    .pacing        = PACING_VSYNC,
+    .fps_cap       = 60,
+    .time_scale    = 1,
+    .rewind_budget  = 16 << 20,
+    .perf_runs      = 5,
+    .perf_tolerance = 10,
+};
+
+void print_usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [options]\n", program);
+    fprintf(stderr, "    --jobs <threads>  worker threads, 0 = one per core, 1 = deterministic\n");
+    fprintf(stderr, "    --vsync           wait for vertical sync (default)\n");
+    fprintf(stderr, "    --fps <cap>       limit frames per second without vsync\n");
+    fprintf(stderr, "    --uncapped        present every frame as soon as it is ready\n");
+    fprintf(stderr, "    --frame-stats     print frame time statistics every few seconds\n");
+    fprintf(stderr, "    --record-input <file>  write every input event to file\n");
+    fprintf(stderr, "    --late-latch      sample input for the player right before the upload\n");
+    fprintf(stderr, "    --time-scale <x>  game speed, 0.5 is slow motion, 2 is fast forward\n");
+    fprintf(stderr, "    --cache-dir <dir> where to keep shader binaries and other caches\n");
+    fprintf(stderr, "    --resource-dir <dir>  use resources from dir instead of the packed ones\n");
+    fprintf(stderr, "    --asset-pack <file>   map this asset pack instead of the embedded one\n");
+    fprintf(stderr, "    --verify-assets   check the hash of every asset that is loaded\n");
+    fprintf(stderr, "    --hot-reload      reload shaders and sprites from --resource-dir when they change\n");
+    fprintf(stderr, "    --track-memory    count memory per subsystem and report leaks on exit\n");
+    fprintf(stderr, "    --rewind-budget <MiB>  memory for rewinding with R, 0 turns it off (default 16)\n");
+    fprintf(stderr, "    --netplay loopback  second player on the arrow keys and Enter, through a loopback connection\n");
+    fprintf(stderr, "    --host <port>     play together with whoever joins on this UDP port\n");
+    fprintf(stderr, "    --join <host>:<port>  play together with a --host\n");
+    fprintf(stderr, "    --net-latency <ms>    delay every packet we send\n");
+    fprintf(stderr, "    --net-loss <percent>  lose some of the packets we send\n");
+    fprintf(stderr, "    --server <port>   run without a window for thin clients, --uncapped runs as fast as it can\n");
+    fprintf(stderr, "    --connect <host>:<port>  be a thin client of a --server\n");
+    fprintf(stderr, "    --bots <n>        with --connect, run n clients without a window to load the server\n");
+    fprintf(stderr, "    --spectate <port|path>  stream the screen to viewers over TCP or a Unix socket\n");
+    fprintf(stderr, "    --capture <file>  record the screen, raw video for .y4m, PNG key frames and deltas otherwise\n");
+    fprintf(stderr, "    --replay <file>   play a --record-input file without a window, can be given more than once\n");
+    fprintf(stderr, "    --golden <dir>    with --replay, check the frames against the golden ones in dir\n");
+    fprintf(stderr, "    --update-golden   with --golden, write the golden frames instead\n");
+    fprintf(stderr, "    --perf-check <file>  time the stages of the replays and compare them with the baseline in file\n");
+    fprintf(stderr, "    --perf-runs <n>   with --perf-check, play every replay n times (default 5)\n");
+    fprintf(stderr, "    --perf-tolerance <percent>  with --perf-check, how much slower a stage may get (default 10)\n");
+    fprintf(stderr, "    --update-baseline  with --perf-check, write the baseline instead\n");
+}
+
+// returns false after printing the usage if an argument is unknown
+bool parse_arguments(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            CONFIG.job_threads = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            CONFIG.pacing = PACING_VSYNC;
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            CONFIG.pacing  = PACING_CAPPED;
+            CONFIG.fps_cap = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            CONFIG.pacing = PACING_UNCAPPED;
+        } else if (strcmp(argv[i], "--frame-stats") == 0) {
+            CONFIG.frame_stats = true;
+        } else if (strcmp(argv[i], "--record-input") == 0 && i + 1 < argc) {
+            CONFIG.record_input = argv[++i];
+        } else if (strcmp(argv[i], "--late-latch") == 0) {
+            CONFIG.late_latch = true;
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            CONFIG.time_scale = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            CONFIG.cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--resource-dir") == 0 && i + 1 < argc) {
+            CONFIG.resource_dir = argv[++i];
+        } else if (strcmp(argv[i], "--asset-pack") == 0 && i + 1 < argc) {
+            CONFIG.asset_pack = argv[++i];
+        } else if (strcmp(argv[i], "--verify-assets") == 0) {
+            CONFIG.verify_assets = true;
+        } else if (strcmp(argv[i], "--hot-reload") == 0) {
+            CONFIG.hot_reload = true;
+        } else if (strcmp(argv[i], "--track-memory") == 0) {
+            CONFIG.track_memory = true;
+        } else if (strcmp(argv[i], "--rewind-budget") == 0 && i + 1 < argc) {
+            CONFIG.rewind_budget = strtoul(argv[++i], NULL, 10) << 20;
+        } else if (strcmp(argv[i], "--netplay") == 0 && i + 1 < argc && strcmp(argv[i + 1], "loopback") == 0) {
+            CONFIG.netplay = NETPLAY_LOOPBACK;
+            i++;
+        } else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+            CONFIG.netplay     = NETPLAY_HOST;
+            CONFIG.net_address = argv[++i];
+        } else if (strcmp(argv[i], "--join") == 0 && i + 1 < argc && strrchr(argv[i + 1], ':')) {
+            CONFIG.netplay     = NETPLAY_JOIN;
+            CONFIG.net_address = argv[++i];
+        } else if (strcmp(argv[i], "--net-latency") == 0 && i + 1 < argc) {
+            CONFIG.net_latency = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--net-loss") == 0 && i + 1 < argc) {
+            CONFIG.net_loss = strtod(argv[++i], NULL) / 100;
+        } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            CONFIG.server_port = argv[++i];
+        } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            CONFIG.connect_address = argv[++i];
+        } else if (strcmp(argv[i], "--bots") == 0 && i + 1 < argc) {
+            CONFIG.bots = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--spectate") == 0 && i + 1 < argc) {
+            CONFIG.spectate = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            CONFIG.capture = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            if (CONFIG.number_of_replays < MAX_REPLAYS)
+                CONFIG.replays[CONFIG.number_of_replays++] = argv[i + 1];
+            else
+                fprintf(stderr, "ERROR: Only %d replays are supported, ignoring %s\n", MAX_REPLAYS, argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            CONFIG.golden = argv[++i];
+        } else if (strcmp(argv[i], "--update-golden") == 0) {
+            CONFIG.update_golden = true;
+        } else if (strcmp(argv[i], "--perf-check") == 0 && i + 1 < argc) {
+            CONFIG.perf_check = argv[++i];
+        } else if (strcmp(argv[i], "--perf-runs") == 0 && i + 1 < argc) {
+            CONFIG.perf_runs = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--perf-tolerance") == 0 && i + 1 < argc) {
+            CONFIG.perf_tolerance = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--update-baseline") == 0) {
+            CONFIG.update_baseline = true;
+        } else {
+            fprintf(stderr, "ERROR: Unknown argument %s\n", argv[i]);
+            print_usage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+//==========Job System==========//
+// A small work-stealing scheduler. Every worker owns a Chase-Lev deque: the
+// owner pushes and pops at the bottom, idle workers steal from the top.
+// Range jobs are split in halves until they are not bigger than their grain,
+// which gives us parallel-for. Dependencies are counters: a job is pushed when
+// the last job it depends on finishes.
+// Any registered thread can submit jobs. Its pool and in-flight counter are
+// its own, so the simulation and the render thread can wait independently.
+// With a single worker nothing is split or stolen and every thread runs its
+// own jobs in order, which keeps the frame deterministic for debugging.
+#define JOB_MAX_WORKERS       64
+#define JOB_EXTERNAL_THREADS  2 // threads that submit jobs but are not workers
+#define JOB_DEQUE_CAPACITY    1024 // must be a power of two
+#define JOB_POOL_SIZE         1024
+#define JOB_MAX_CONTINUATIONS 4
+#define JOB_SPIN_COUNT        64
+
+typedef void (*JobFunc)(void *data, size_t begin, size_t end);
+
+typedef struct Job Job;
+struct Job {
+    JobFunc func;
+    void *data;
+    size_t begin, end;
+    size_t grain;
+    Job *parent;
+    size_t owner; // worker whose pool the job lives in
+    atomic_int dependencies; // jobs that have to finish before this one can run
+    atomic_int unfinished;   // this job and its children that are still running
+    Job *continuations[JOB_MAX_CONTINUATIONS];
+    size_t number_of_continuations;
+};
+
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    Job *_Atomic jobs[JOB_DEQUE_CAPACITY];
+} JobDeque;
+
+typedef struct {
+    JobDeque deque;
+    Job *pool;
+    atomic_size_t pool_used;
+    atomic_int in_flight; // jobs from the pool that have not finished running yet
+    uint32_t random_state;
+    Arena scratch; // for the job that runs on this thread, see job_scratch_arena()
+    pthread_t thread;
+} JobWorker;
+
+static struct {
+    JobWorker *workers;
+    size_t number_of_workers; // deques to steal from, including external threads
+    size_t number_of_threads; // threads running worker loop, including main thread
+    atomic_size_t registered;
+    bool deterministic;
+    atomic_int queued; // jobs sitting in a deque
+    atomic_int sleeping;
+    atomic_bool running;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+} JOBS;
+
+static _Thread_local int job_worker_index = -1;
+
+bool job_deque_push(JobDeque *deque, Job *job)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top    = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= JOB_DEQUE_CAPACITY)
+        return false;
+    atomic_store_explicit(&deque->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+Job *job_deque_pop(JobDeque *deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    Job *job = atomic_load_explicit(&deque->jobs[bottom & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // last job, race against the thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+            job = NULL;
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+Job *job_deque_steal(JobDeque *deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom)
+        return NULL;
+    Job *job = atomic_load_explicit(&deque->jobs[top & (JOB_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+    return job;
+}
+
+static Job *job_alloc(size_t owner)
+{
+    JobWorker *worker = &JOBS.workers[owner];
+    size_t index      = atomic_fetch_add(&worker->pool_used, 1);
+    if (index >= JOB_POOL_SIZE)
+        return NULL;
+    Job *job   = &worker->pool[index];
+    job->owner = owner;
+    atomic_fetch_add(&worker->in_flight, 1);
+    return job;
+}
+
+void job_execute(Job *job);
+
+static void job_push(Job *job)
+{
+    if (!job_deque_push(&JOBS.workers[job_worker_index].deque, job)) {
+        // deque is full, just do the work here
+        job_execute(job);
+        return;
+    }
+    atomic_fetch_add(&JOBS.queued, 1);
+    if (atomic_load(&JOBS.sleeping) > 0) {
+        pthread_mutex_lock(&JOBS.mutex);
+        pthread_cond_signal(&JOBS.wake);
+        pthread_mutex_unlock(&JOBS.mutex);
+    }
+}
+
+static void job_finish(Job *job)
+{
+    if (atomic_fetch_sub(&job->unfinished, 1) != 1)
+        return;
+    if (job->parent)
+        job_finish(job->parent);
+    for (size_t i = 0; i < job->number_of_continuations; i++)
+        if (atomic_fetch_sub(&job->continuations[i]->dependencies, 1) == 1)
+            job_push(job->continuations[i]);
+}
+
+void job_execute(Job *job)
+{
+    size_t owner = job->owner;
+    if (!JOBS.deterministic) {
+        while (job->end - job->begin > job->grain) {
+            Job *child = job_alloc(owner);
+            if (!child)
+                break;
+            size_t middle = job->begin + (job->end - job->begin) / 2;
+            child->func   = job->func;
+            child->data   = job->data;
+            child->begin  = middle;
+            child->end    = job->end;
+            child->grain  = job->grain;
+            child->parent = job;
+            child->number_of_continuations = 0;
+            atomic_init(&child->dependencies, 0);
+            atomic_init(&child->unfinished, 1);
+            atomic_fetch_add(&job->unfinished, 1);
+            job->end = middle;
+            job_push(child);
+        }
+    }
+    // a job can run another one inline while it waits, so restore instead of reset
+    Arena *scratch = &JOBS.workers[job_worker_index].scratch;
+    size_t mark    = arena_mark(scratch);
+    job->func(job->data, job->begin, job->end);
+    arena_restore(scratch, mark);
+    job_finish(job);
+    // nothing may touch the job after this point, the pool can be reset
+    atomic_fetch_sub(&JOBS.workers[owner].in_flight, 1);
+}
+
+static Job *job_find_work()
+{
+    JobWorker *worker = &JOBS.workers[job_worker_index];
+    Job *job          = job_deque_pop(&worker->deque);
+    if (!job && !JOBS.deterministic) {
+        // xorshift to pick where to start stealing from
+        worker->random_state ^= worker->random_state << 13;
+        worker->random_state ^= worker->random_state >> 17;
+        worker->random_state ^= worker->random_state << 5;
+        size_t start = worker->random_state % JOBS.number_of_workers;
+        for (size_t i = 0; i < JOBS.number_of_workers && !job; i++) {
+            size_t victim = (start + i) % JOBS.number_of_workers;
+            if (victim != (size_t)job_worker_index)
+                job = job_deque_steal(&JOBS.workers[victim].deque);
+        }
+    }
+    if (job)
+        atomic_fetch_sub(&JOBS.queued, 1);
+    return job;
+}
+
+static void *job_worker_main(void *arg)
+{
+    job_worker_index = (int)(intptr_t)arg;
+    size_t idle      = 0;
+    while (atomic_load(&JOBS.running)) {
+        Job *job = job_find_work();
+        if (job) {
+            job_execute(job);
+            idle = 0;
+            continue;
+        }
+        // stages of a frame come in quick bursts, spin a little before sleeping
+        if (idle++ < JOB_SPIN_COUNT) {
+            sched_yield();
+            continue;
+        }
+        idle = 0;
+        pthread_mutex_lock(&JOBS.mutex);
+        atomic_fetch_add(&JOBS.sleeping, 1);
+        if (atomic_load(&JOBS.queued) == 0 && atomic_load(&JOBS.running))
+            pthread_cond_wait(&JOBS.wake, &JOBS.mutex);
+        atomic_fetch_sub(&JOBS.sleeping, 1);
+        pthread_mutex_unlock(&JOBS.mutex);
+    }
+    return NULL;
+}
+
+// number_of_threads counts the calling thread too, 0 means one per core and 1
+// runs every job in order on the thread that submitted it
+bool init_job_system(size_t number_of_threads)
+{
+    if (number_of_threads == 0) {
+        long cores        = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_threads = cores > 0 ? (size_t)cores : 1;
+    }
+    if (number_of_threads > JOB_MAX_WORKERS)
+        number_of_threads = JOB_MAX_WORKERS;
+
+    size_t number_of_workers = number_of_threads + JOB_EXTERNAL_THREADS;
+    JOBS.workers             = memory_calloc(MEMORY_JOBS, number_of_workers, sizeof(JobWorker));
+    if (!JOBS.workers) {
+        fprintf(stderr, "ERROR: Could not malloc memory for job workers. Please buy more RAM!\n");
+        return false;
+    }
+    for (size_t i = 0; i < number_of_workers; i++) {
+        JOBS.workers[i].pool = memory_alloc(MEMORY_JOBS, JOB_POOL_SIZE * sizeof(Job));
+        if (!JOBS.workers[i].pool) {
+            fprintf(stderr, "ERROR: Could not malloc memory for job pool. Please buy more RAM!\n");
+            return false;
+        }
+        JOBS.workers[i].random_state = (uint32_t)(i * 2654435761u) | 1;
+        if (!init_arena(&JOBS.workers[i].scratch, "job scratch", SCRATCH_ARENA_SIZE))
+            return false;
+    }
+    JOBS.number_of_workers = number_of_workers;
+    JOBS.number_of_threads = number_of_threads;
+    JOBS.deterministic     = number_of_threads == 1;
+    atomic_init(&JOBS.registered, number_of_threads);
+    atomic_init(&JOBS.queued, 0);
+    atomic_init(&JOBS.sleeping, 0);
+    atomic_init(&JOBS.running, true);
+    pthread_mutex_init(&JOBS.mutex, NULL);
+    pthread_cond_init(&JOBS.wake, NULL);
+
+    job_worker_index = 0;
+    for (size_t i = 1; i < number_of_threads; i++) {
+        if (pthread_create(&JOBS.workers[i].thread, NULL, job_worker_main, (void *)(intptr_t)i) != 0) {
+            fprintf(stderr, "ERROR: Could not create job worker thread %zu\n", i);
+            JOBS.number_of_threads = i;
+            break;
+        }
+    }
+    printf("INFO : Job system started with %zu thread(s)!\n", JOBS.number_of_threads);
+    return true;
+}
+
+// scratch memory of the calling thread for the job it is running, everything
+// is freed when the job returns
+static inline Arena *job_scratch_arena()
+{
+    return &JOBS.workers[job_worker_index].scratch;
+}
+
+// lets a thread that is not a worker (e.g. the render thread) submit jobs
+bool job_register_thread()
+{
+    size_t index = atomic_fetch_add(&JOBS.registered, 1);
+    if (index >= JOBS.number_of_workers) {
+        fprintf(stderr, "ERROR: Too many threads registered to the job system!\n");
+        return false;
+    }
+    job_worker_index = (int)index;
+    return true;
+}
+
+void shutdown_job_system()
+{
+    pthread_mutex_lock(&JOBS.mutex);
+    atomic_store(&JOBS.running, false);
+    pthread_cond_broadcast(&JOBS.wake);
+    pthread_mutex_unlock(&JOBS.mutex);
+    for (size_t i = 1; i < JOBS.number_of_threads; i++)
+        pthread_join(JOBS.workers[i].thread, NULL);
+    Arena *busiest = &JOBS.workers[0].scratch;
+    for (size_t i = 0; i < JOBS.number_of_workers; i++)
+        if (JOBS.workers[i].scratch.peak > busiest->peak)
+            busiest = &JOBS.workers[i].scratch;
+    print_arena_peak(busiest);
+    for (size_t i = 0; i < JOBS.number_of_workers; i++) {
+        memory_free(JOBS.workers[i].pool);
+        free_arena(&JOBS.workers[i].scratch);
+    }
+    memory_free(JOBS.workers);
+    pthread_mutex_destroy(&JOBS.mutex);
+    pthread_cond_destroy(&JOBS.wake);
+}
+
+// creates a job over [begin, end). It is held back until job_submit() so that
+// dependencies can be added first.
+Job *job_create(JobFunc func, void *data, size_t begin, size_t end, size_t grain)
+{
+    Job *job = job_alloc(job_worker_index);
+    if (!job) {
+        fprintf(stderr, "ERROR: Job pool is exhausted!\n");
+        return NULL;
+    }
+    job->func   = func;
+    job->data   = data;
+    job->begin  = begin;
+    job->end    = end;
+    job->grain  = grain ? grain : 1;
+    job->parent = NULL;
+    job->number_of_continuations = 0;
+    atomic_init(&job->dependencies, 1);
+    atomic_init(&job->unfinished, 1);
+    return job;
+}
+
+// gives back a job that was created but will not be submitted, so that
+// job_wait_all() does not wait for it
+void job_release(Job *job)
+{
+    atomic_fetch_sub(&JOBS.workers[job->owner].in_flight, 1);
+}
+
+// job will not start before dependency finishes. Must be called before either
+// of them is submitted.
+void job_depends_on(Job *job, Job *dependency)
+{
+    if (dependency->number_of_continuations >= JOB_MAX_CONTINUATIONS) {
+        fprintf(stderr, "ERROR: Too many jobs depend on a single job!\n");
+        return;
+    }
+    dependency->continuations[dependency->number_of_continuations++] = job;
+    atomic_fetch_add(&job->dependencies, 1);
+}
+
+void job_submit(Job *job)
+{
+    if (atomic_fetch_sub(&job->dependencies, 1) == 1)
+        job_push(job);
+}
+
+// helps running jobs until every job this thread submitted is done and
+// resets its pool
+void job_wait_all()
+{
+    JobWorker *worker = &JOBS.workers[job_worker_index];
+    while (atomic_load(&worker->in_flight) > 0) {
+        Job *job = job_find_work();
+        if (job)
+            job_execute(job);
+        else
+            sched_yield();
+    }
+    atomic_store(&worker->pool_used, 0);
+}
+
+//==========Frame==========//
+// The simulation runs on the main thread because GLFW wants input to be
+// polled there. It ticks at a fixed rate, all the speeds are per tick.
+#define NUMBER_OF_ENEMIES (NUMBER_OF_GREEN_ENEMIES_IN_ROW + NUMBER_OF_RED_ENEMIES_IN_ROW)
+#define ENEMY_JOB_GRAIN   8
+
+typedef struct {
+    size_t local_player; // drawn first, late latching moves it
+    EntityHandle *green_enemies;
+    EntityHandle *red_enemies;
+    size_t *hits; // NUMBER_OF_ENEMIES, from FRAME_ARENA
+    uint64_t game_tick; // from the frame clock
+    uint64_t tick;
+    int64_t pending_input_time; // oldest input not shown on screen yet, 0 if none
+    uint64_t pending_input_tick;
+} Frame;
+
+static inline EntityHandle frame_enemy(Frame *frame, size_t i)
+{
+    if (i < NUMBER_OF_GREEN_ENEMIES_IN_ROW)
+        return frame->green_enemies[i];
+    return frame->red_enemies[i - NUMBER_OF_GREEN_ENEMIES_IN_ROW];
+}
+
+void fire_movement_job(void *data, size_t begin, size_t end)
+{
+    moving_fires();
+}
+
+void enemy_movement_job(void *data, size_t begin, size_t end)
+{
+    Frame *frame = data;
+    for (size_t i = begin; i < end; i++) {
+        Object *enemy = entity_get(&ENTITIES, frame_enemy(frame, i));
+        if (enemy != NULL)
+            moving_enemy_animation(enemy, frame->game_tick);
+    }
+}
+
+void collision_search_job(void *data, size_t begin, size_t end)
+{
+    Frame *frame = data;
+    for (size_t i = begin; i < end; i++) {
+        Object *enemy  = entity_get(&ENTITIES, frame_enemy(frame, i));
+        frame->hits[i] = enemy ? find_collision(enemy, player_fires, 0, MAX_PLAYER_FIRES) : NO_COLLISION;
+    }
+}
+
+// hits are assigned in enemy order so the result is the same as checking the
+// enemies one by one. If an earlier enemy already took the fire we look for
+// the next one, none of the fires before it could hit anyway. Nothing is
+// deleted here, the hit events do that when they are dispatched.
+void collision_resolve_job(void *data, size_t begin, size_t end)
+{
+    Frame *frame = data;
+    bool *taken  = arena_alloc(job_scratch_arena(), MAX_PLAYER_FIRES * sizeof(bool));
+    if (!taken)
+        return;
+    memset(taken, 0, MAX_PLAYER_FIRES * sizeof(bool));
+    for (size_t i = 0; i < NUMBER_OF_ENEMIES; i++) {
+        EntityHandle enemy = frame_enemy(frame, i);
+        size_t hit         = frame->hits[i];
+        while (hit != NO_COLLISION && taken[hit])
+            hit = find_collision(entity_get(&ENTITIES, enemy), player_fires, hit + 1, MAX_PLAYER_FIRES);
+        if (hit == NO_COLLISION)
+            continue;
+        taken[hit]      = true;
+        GameEvent event = object_event(enemy);
+        event.other     = player_fires[hit];
+        event_emit(&EVENTS, EVENT_HIT, event);
+    }
+}
+
+// Animation frames and enemy fire come from the timer wheel before this runs.
+//  fire movement -+-> collision search -> collision resolve
+// enemy movement -+
+void run_frame_jobs(Frame *frame)
+{
+    frame->hits = arena_alloc(&FRAME_ARENA, NUMBER_OF_ENEMIES * sizeof(size_t));
+    if (!frame->hits)
+        return;
+    Job *fires    = job_create(fire_movement_job, frame, 0, 1, 1);
+    Job *movement = job_create(enemy_movement_job, frame, 0, NUMBER_OF_ENEMIES, ENEMY_JOB_GRAIN);
+    Job *search   = job_create(collision_search_job, frame, 0, NUMBER_OF_ENEMIES, ENEMY_JOB_GRAIN);
+    Job *resolve  = job_create(collision_resolve_job, frame, 0, 1, 1);
+    if (!fires || !movement || !search || !resolve) {
+        Job *created[] = { fires, movement, search, resolve };
+        for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++) {
+            if (created[i])
+                job_release(created[i]);
+        }
+        job_wait_all();
+        return;
+    }
+
+    job_depends_on(search, fires);
+    job_depends_on(search, movement);
+    job_depends_on(resolve, search);
+
+    job_submit(resolve);
+    job_submit(search);
+    job_submit(fires);
+    job_submit(movement);
+    job_wait_all();
+}
+
+// run_frame_jobs() in two steps that do not overlap, so that --perf-check can
+// time the movement and the collisions apart
+void run_movement_jobs(Frame *frame)
+{
+    Job *fires    = job_create(fire_movement_job, frame, 0, 1, 1);
+    Job *movement = job_create(enemy_movement_job, frame, 0, NUMBER_OF_ENEMIES, ENEMY_JOB_GRAIN);
+    if (fires && movement) {
+        job_submit(fires);
+        job_submit(movement);
+    } else if (fires || movement) {
+        job_release(fires ? fires : movement);
+    }
+    job_wait_all();
+}
+
+void run_collision_jobs(Frame *frame)
+{
+    frame->hits = arena_alloc(&FRAME_ARENA, NUMBER_OF_ENEMIES * sizeof(size_t));
+    if (!frame->hits)
+        return;
+    Job *search  = job_create(collision_search_job, frame, 0, NUMBER_OF_ENEMIES, ENEMY_JOB_GRAIN);
+    Job *resolve = job_create(collision_resolve_job, frame, 0, 1, 1);
+    if (search && resolve) {
+        job_depends_on(resolve, search);
+        job_submit(resolve);
+        job_submit(search);
+    } else if (search || resolve) {
+        job_release(search ? search : resolve);
+    }
+    job_wait_all();
+}
+
+// the part of a tick before the frame jobs
+void begin_tick(Frame *frame, const uint8_t *buttons)
+{
+    EVENTS.tick = frame->tick;
+    timer_wheel_advance(&TIMERS);
+    for (size_t i = 0; i < NUMBER_OF_PLAYERS; i++)
+        check_player_action(i, buttons[i]);
+    frame->game_tick = game_ticks(&CLOCK);
+}
+
+// One tick of the game with the buttons of every player. Rewinding and
+// netplay load earlier states and run ticks again, so everything this touches
+// has to be part of the save state.
+void simulate_tick(Frame *frame, const uint8_t *buttons)
+{
+    begin_tick(frame, buttons);
+    run_frame_jobs(frame);
+    dispatch_events(&EVENTS);
+}
+
+//==========Transport==========//
+// Netplay packets go through a Transport, which is a few function pointers.
+// The loopback one hands packets to another Transport in the same process,
+// the UDP one sends them to a socket. In front of either we can lose and
+// delay packets on purpose (--net-loss, --net-latency) to see how netplay
+// copes with a bad connection. A delayed packet waits in a queue until it is
+// due and is sent the next time the transport is used.
+#define TRANSPORT_MAX_PACKET 512
+#define TRANSPORT_QUEUE_SIZE 1024 // must be a power of two
+
+typedef struct {
+    int64_t due;
+    size_t size;
+    uint8_t data[TRANSPORT_MAX_PACKET];
+} Packet;
+
+typedef struct {
+    Packet packets[TRANSPORT_QUEUE_SIZE];
+    size_t head, tail;
+} PacketQueue;
+
+typedef struct Transport Transport;
+struct Transport {
+    bool (*send)(Transport *transport, const uint8_t *data, size_t size);
+    size_t (*receive)(Transport *transport, uint8_t *data, size_t capacity); // 0 if nothing came
+    void (*close)(Transport *transport);
+    int64_t latency; // ns added to every packet we send
+    double loss;     // share of the packets we send that are lost
+    uint64_t random_state;
+    PacketQueue *delayed;
+    PacketQueue *inbox; // loopback
+    Transport *peer;    // loopback
+    int socket;         // udp
+    struct sockaddr_in address;
+    bool has_address; // a host learns it from the first packet
+    uint64_t sent, lost, received;
+};
+
+static bool packet_queue_push(PacketQueue *queue, int64_t due, const uint8_t *data, size_t size)
+{
+    if (queue->head - queue->tail >= TRANSPORT_QUEUE_SIZE || size > TRANSPORT_MAX_PACKET)
+        return false;
+    Packet *packet = &queue->packets[queue->head++ & (TRANSPORT_QUEUE_SIZE - 1)];
+    packet->due    = due;
+    packet->size   = size;
+    memcpy(packet->data, data, size);
+    return true;
+}
+
+// the oldest packet if it is due
+static Packet *packet_queue_peek(PacketQueue *queue, int64_t now)
+{
+    if (queue->head == queue->tail)
+        return NULL;
+    Packet *packet = &queue->packets[queue->tail & (TRANSPORT_QUEUE_SIZE - 1)];
+    return packet->due <= now ? packet : NULL;
+}
+
+static bool loopback_send(Transport *transport, const uint8_t *data, size_t size)
+{
+    return packet_queue_push(transport->peer->inbox, 0, data, size);
+}
+
+static size_t loopback_receive(Transport *transport, uint8_t *data, size_t capacity)
+{
+    Packet *packet = packet_queue_peek(transport->inbox, INT64_MAX);
+    if (!packet || packet->size > capacity)
+        return 0;
+    memcpy(data, packet->data, packet->size);
+    transport->inbox->tail++;
+    return packet->size;
+}
+
+static void loopback_close(Transport *transport)
+{
+    memory_free(transport->inbox);
+}
+
+static bool udp_send(Transport *transport, const uint8_t *data, size_t size)
+{
+    if (!transport->has_address)
+        return false;
+    return sendto(transport->socket, data, size, 0, (struct sockaddr *)&transport->address, sizeof(transport->address)) == (ssize_t)size;
+}
+
+static size_t udp_receive(Transport *transport, uint8_t *data, size_t capacity)
+{
+    for (;;) {
+        struct sockaddr_in from;
+        socklen_t length = sizeof(from);
+        ssize_t size     = recvfrom(transport->socket, data, capacity, 0, (struct sockaddr *)&from, &length);
+        if (size <= 0)
+            return 0;
+        if (!transport->has_address) {
+            transport->address     = from;
+            transport->has_address = true;
+            printf("INFO : %s:%d joined\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+        }
+        // only one peer, everybody else is ignored
+        if (from.sin_addr.s_addr == transport->address.sin_addr.s_addr && from.sin_port == transport->address.sin_port)
+            return size;
+    }
+}
+
+static void udp_close(Transport *transport)
+{
+    close(transport->socket);
+}
+
+static bool init_transport(Transport *transport, double latency_ms, double loss)
+{
+    transport->latency      = (int64_t)(latency_ms * 1e6);
+    transport->loss         = loss;
+    transport->random_state = 0x2545F4914F6CDD1D ^ (uint64_t)now_ns();
+    transport->delayed      = memory_calloc(MEMORY_NETPLAY, 1, sizeof(PacketQueue));
+    if (!transport->delayed) {
+        fprintf(stderr, "ERROR: Could not malloc memory for a transport. Please buy more RAM!\n");
+        return false;
+    }
+    return true;
+}
+
+// a pair of transports that send to each other
+bool open_loopback_transports(Transport *a, Transport *b, double latency_ms, double loss)
+{
+    Transport *ends[] = { a, b };
+    for (size_t i = 0; i < 2; i++) {
+        *ends[i] = (Transport){ .send = loopback_send, .receive = loopback_receive, .close = loopback_close, .peer = ends[1 - i] };
+        if (!init_transport(ends[i], latency_ms, loss))
+            return false;
+        ends[i]->inbox = memory_calloc(MEMORY_NETPLAY, 1, sizeof(PacketQueue));
+        if (!ends[i]->inbox) {
+            fprintf(stderr, "ERROR: Could not malloc memory for a transport. Please buy more RAM!\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+// address is host:port
+bool resolve_address(const char *address, struct sockaddr_in *resolved)
+{
+    char host[256];
+    const char *port = strrchr(address, ':');
+    if (!port) {
+        fprintf(stderr, "ERROR: %s is not <host>:<port>\n", address);
+        return false;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(port - address), address);
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *info = NULL;
+    int error             = getaddrinfo(host, port + 1, &hints, &info);
+    if (error) {
+        fprintf(stderr, "ERROR: Could not find %s: %s\n", address, gai_strerror(error));
+        return false;
+    }
+    memcpy(resolved, info->ai_addr, sizeof(*resolved));
+    freeaddrinfo(info);
+    return true;
+}
+
+// a non blocking UDP socket, bound to port if there is one
+int open_udp_socket(const char *port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Could not open a UDP socket: %s\n", strerror(errno));
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (!port)
+        return fd;
+    struct sockaddr_in address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons((uint16_t)atoi(port)) };
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: Could not listen on UDP port %s: %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Listening we wait on port for the first one who sends us something,
+// otherwise we send to address, which is host:port.
+bool open_udp_transport(Transport *transport, const char *address, bool listen, double latency_ms, double loss)
+{
+    *transport = (Transport){ .send = udp_send, .receive = udp_receive, .close = udp_close };
+    if (!init_transport(transport, latency_ms, loss))
+        return false;
+    if (!listen && !resolve_address(address, &transport->address))
+        return false;
+    transport->has_address = !listen;
+    transport->socket      = open_udp_socket(listen ? address : NULL);
+    if (transport->socket < 0)
+        return false;
+    if (listen)
+        printf("INFO : Waiting for a player to join on UDP port %s\n", address);
+    return true;
+}
+
+// hands the delayed packets that are due to the transport
+static void transport_flush(Transport *transport)
+{
+    int64_t now = transport->latency ? now_ns() : 0;
+    Packet *packet;
+    while ((packet = packet_queue_peek(transport->delayed, now))) {
+        transport->send(transport, packet->data, packet->size);
+        transport->delayed->tail++;
+    }
+}
+
+void transport_send(Transport *transport, const uint8_t *data, size_t size)
+{
+    transport->sent++;
+    transport->random_state ^= transport->random_state >> 12;
+    transport->random_state ^= transport->random_state << 25;
+    transport->random_state ^= transport->random_state >> 27;
+    double chance = (transport->random_state * 0x2545F4914F6CDD1D >> 11) * 0x1p-53;
+    if (chance < transport->loss) {
+        transport->lost++;
+        return;
+    }
+    // packets keep their order, so they can only leave after the ones before
+    if (transport->latency == 0 && transport->delayed->head == transport->delayed->tail)
+        transport->send(transport, data, size);
+    else if (!packet_queue_push(transport->delayed, now_ns() + transport->latency, data, size))
+        transport->lost++;
+    transport_flush(transport);
+}
+
+size_t transport_receive(Transport *transport, uint8_t *data, size_t capacity)
+{
+    transport_flush(transport);
+    size_t size = transport->receive(transport, data, capacity);
+    if (size)
+        transport->received++;
+    return size;
+}
+
+void close_transport(Transport *transport)
+{
+    if (!transport->close)
+        return;
+    transport->close(transport);
+    memory_free(transport->delayed);
+    *transport = (Transport){ 0 };
+}
+
+//==========Netplay==========//
+// Rollback netplay for two players. Every peer simulates the whole game with
+// the buttons of both players and sends its own buttons to the other one.
+// Until the remote buttons of a tick arrive we guess that they did not change.
+// When they arrive and the guess was wrong, we load the state saved before
+// that tick and simulate again up to now with the right buttons. Buttons
+// change rarely, so most ticks are never simulated twice.
+// A peer does not run more than NETPLAY_MAX_ROLLBACK ticks ahead of the
+// remote buttons it has, it waits (a stall) instead. It also waits a tick
+// now and then while it is ahead of the other peer, or the one ahead would
+// always be the one rolling back.
+// Every packet carries all our buttons the peer has not acknowledged yet, so
+// a lost packet costs nothing but the time until the next one.
+#define NETPLAY_MAX_ROLLBACK  128 // ticks, one saved state each
+#define NETPLAY_HISTORY       512 // ticks of buttons we keep, must be a power of two
+#define NETPLAY_MAX_ADVANTAGE 2   // ticks ahead of the other peer before we wait
+#define NETPLAY_MAGIC         0x504C4E53 // "SNLP"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;    // buttons after the header
+    uint64_t ack;      // the sender has all our buttons before this tick
+    uint64_t first;    // tick of the first buttons
+    uint64_t tick;     // the next tick of the sender
+    int64_t lead;      // how far the sender is ahead of the newest tick it heard of from us
+} InputPacketHeader;
+
+#define NETPLAY_MAX_PACKET_BUTTONS (TRANSPORT_MAX_PACKET - sizeof(InputPacketHeader))
+
+typedef struct {
+    Transport *transport;
+    uint8_t sent[NETPLAY_HISTORY]; // our buttons by tick
+    uint64_t sent_until;           // we have our buttons of the ticks before this
+    uint64_t acked;                // the peer has our buttons of the ticks before this
+    uint8_t received[NETPLAY_HISTORY];
+    uint64_t received_until;
+    uint64_t remote_tick; // newest tick the peer told us about
+    int64_t remote_lead;
+} InputChannel;
+
+typedef struct {
+    InputChannel channel;
+    size_t local, remote; // player indices
+    uint64_t tick;        // next one to simulate
+    uint8_t buttons[NETPLAY_HISTORY][MAX_PLAYERS]; // that each tick was simulated with
+    uint8_t *states; // NETPLAY_MAX_ROLLBACK states of MAX_GAME_STATE_SIZE, before each tick
+    size_t state_sizes[NETPLAY_MAX_ROLLBACK];
+    uint64_t stalls, waits, rollbacks, resimulated, longest_rollback;
+    int64_t resimulate_time; // ns
+} Netplay;
+
+static Netplay NETPLAY;
+static Transport NETPLAY_TRANSPORT;
+// the other end of --netplay loopback, it plays the second player
+static Transport LOOPBACK_TRANSPORT;
+static InputChannel LOOPBACK_PEER;
+
+void channel_push(InputChannel *channel, uint8_t buttons)
+{
+    channel->sent[channel->sent_until++ & (NETPLAY_HISTORY - 1)] = buttons;
+}
+
+// sends every buttons the peer does not have yet, tick is our next one
+void channel_flush(InputChannel *channel, uint64_t tick)
+{
+    uint8_t packet[TRANSPORT_MAX_PACKET];
+    InputPacketHeader header = {
+        .magic = NETPLAY_MAGIC,
+        .ack   = channel->received_until,
+        .first = channel->acked,
+        .tick  = tick,
+        .lead  = channel->remote_tick ? (int64_t)(tick - channel->remote_tick) : 0,
+    };
+    if (channel->sent_until - header.first > NETPLAY_HISTORY)
+        header.first = channel->sent_until - NETPLAY_HISTORY;
+    header.count = (uint32_t)(channel->sent_until - header.first);
+    if (header.count > NETPLAY_MAX_PACKET_BUTTONS)
+        header.count = NETPLAY_MAX_PACKET_BUTTONS;
+    memcpy(packet, &header, sizeof(header));
+    for (uint32_t i = 0; i < header.count; i++)
+        packet[sizeof(header) + i] = channel->sent[(header.first + i) & (NETPLAY_HISTORY - 1)];
+    transport_send(channel->transport, packet, sizeof(header) + header.count);
+}
+
+// Takes in every packet that came. Returns true with the first tick whose
+// buttons are new if there were any.
+bool channel_receive(InputChannel *channel, uint64_t *first_new)
+{
+    uint8_t packet[TRANSPORT_MAX_PACKET];
+    uint64_t received_until = channel->received_until;
+    size_t size;
+    while ((size = transport_receive(channel->transport, packet, sizeof(packet)))) {
+        InputPacketHeader header;
+        if (size < sizeof(header))
+            continue;
+        memcpy(&header, packet, sizeof(header));
+        if (header.magic != NETPLAY_MAGIC || header.count != size - sizeof(header))
+            continue;
+        if (header.ack > channel->acked && header.ack <= channel->sent_until)
+            channel->acked = header.ack;
+        if (header.tick > channel->remote_tick) {
+            channel->remote_tick = header.tick;
+            channel->remote_lead = header.lead;
+        }
+        // buttons can only be taken in order, a gap is filled by a later packet
+        for (uint32_t i = 0; i < header.count; i++) {
+            if (header.first + i == channel->received_until)
+                channel->received[channel->received_until++ & (NETPLAY_HISTORY - 1)] = packet[sizeof(header) + i];
+        }
+    }
+    *first_new = received_until;
+    return channel->received_until > received_until;
+}
+
+// The host and the loopback peer are player one. address is the port to
+// host on or the host:port to join.
+bool start_netplay(Netplay *netplay, NetplayMode mode, const char *address, double latency_ms, double loss)
+{
+    *netplay = (Netplay){ .channel = { .transport = &NETPLAY_TRANSPORT }, .remote = 1 };
+    bool opened = false;
+    if (mode == NETPLAY_LOOPBACK) {
+        opened        = open_loopback_transports(&NETPLAY_TRANSPORT, &LOOPBACK_TRANSPORT, latency_ms, loss);
+        LOOPBACK_PEER = (InputChannel){ .transport = &LOOPBACK_TRANSPORT };
+    } else if (mode == NETPLAY_HOST) {
+        opened = open_udp_transport(&NETPLAY_TRANSPORT, address, true, latency_ms, loss);
+    } else if (mode == NETPLAY_JOIN) {
+        opened          = open_udp_transport(&NETPLAY_TRANSPORT, address, false, latency_ms, loss);
+        netplay->local  = 1;
+        netplay->remote = 0;
+    }
+    if (!opened)
+        return false;
+    // a state is much smaller than MAX_GAME_STATE_SIZE, the pages after it are never touched
+    netplay->states = memory_alloc(MEMORY_NETPLAY, NETPLAY_MAX_ROLLBACK * MAX_GAME_STATE_SIZE);
+    if (!netplay->states) {
+        fprintf(stderr, "ERROR: Could not malloc memory for netplay. Please buy more RAM!\n");
+        return false;
+    }
+    return true;
+}
+
+void stop_netplay(Netplay *netplay)
+{
+    if (netplay->tick) {
+        printf("INFO : Netplay ran %" PRIu64 " ticks, %" PRIu64 " stalls, %" PRIu64 " waits\n", netplay->tick, netplay->stalls, netplay->waits);
+        printf("INFO : %" PRIu64 " rollbacks, up to %" PRIu64 " ticks, %.2f us per resimulated tick\n", netplay->rollbacks,
+               netplay->longest_rollback, netplay->resimulated ? netplay->resimulate_time / 1e3 / netplay->resimulated : 0.0);
+    }
+    Transport *transport = netplay->channel.transport;
+    if (transport)
+        printf("INFO : Sent %" PRIu64 " packets, lost %" PRIu64 " of them, received %" PRIu64 "\n", transport->sent, transport->lost, transport->received);
+    close_transport(&NETPLAY_TRANSPORT);
+    close_transport(&LOOPBACK_TRANSPORT);
+    memory_free(netplay->states);
+    *netplay = (Netplay){ 0 };
+}
+
+static inline uint8_t *netplay_state(Netplay *netplay, uint64_t tick)
+{
+    return netplay->states + (tick % NETPLAY_MAX_ROLLBACK) * MAX_GAME_STATE_SIZE;
+}
+
+// the remote buttons if we have them, otherwise the newest ones we have
+static inline uint8_t remote_buttons(InputChannel *channel, uint64_t tick)
+{
+    if (tick < channel->received_until)
+        return channel->received[tick & (NETPLAY_HISTORY - 1)];
+    if (channel->received_until == 0)
+        return 0;
+    return channel->received[(channel->received_until - 1) & (NETPLAY_HISTORY - 1)];
+}
+
+// Saves the state before the tick and simulates it. Game time is set from the
+// tick because stalls and rollbacks do not follow the frame clock.
+static void netplay_simulate(Netplay *netplay, Frame *frame, Rules *rules, uint64_t tick)
+{
+    uint8_t *buttons           = netplay->buttons[tick & (NETPLAY_HISTORY - 1)];
+    buttons[netplay->remote]   = remote_buttons(&netplay->channel, tick);
+    size_t slot                = tick % NETPLAY_MAX_ROLLBACK;
+    netplay->state_sizes[slot] = save_game_state(netplay_state(netplay, tick), MAX_GAME_STATE_SIZE, rules);
+    CLOCK.game_time            = (int64_t)(tick + 1) * CLOCK.step;
+    simulate_tick(frame, buttons);
+}
+
+// Loads the state before tick and simulates again up to where we were.
+static void netplay_rollback(Netplay *netplay, Frame *frame, Rules *rules, uint64_t tick)
+{
+    int64_t start = now_ns();
+    size_t slot   = tick % NETPLAY_MAX_ROLLBACK;
+    if (!load_game_state(netplay_state(netplay, tick), netplay->state_sizes[slot], rules))
+        return;
+    uint64_t length = netplay->tick - tick;
+    for (; tick < netplay->tick; tick++)
+        netplay_simulate(netplay, frame, rules, tick);
+    netplay->rollbacks++;
+    netplay->resimulated += length;
+    netplay->resimulate_time += now_ns() - start;
+    if (length > netplay->longest_rollback)
+        netplay->longest_rollback = length;
+}
+
+// Call once per tick with the local buttons. Returns false if it had to wait
+// for the other peer instead of simulating the next tick.
+bool netplay_update(Netplay *netplay, Frame *frame, Rules *rules, uint8_t buttons)
+{
+    InputChannel *channel = &netplay->channel;
+    uint64_t first_new;
+    if (channel_receive(channel, &first_new)) {
+        for (uint64_t tick = first_new; tick < channel->received_until && tick < netplay->tick; tick++) {
+            if (channel->received[tick & (NETPLAY_HISTORY - 1)] != netplay->buttons[tick & (NETPLAY_HISTORY - 1)][netplay->remote]) {
+                netplay_rollback(netplay, frame, rules, tick);
+                break;
+            }
+        }
+    }
+
+    // both peers see the other one a latency behind, the difference of what
+    // they see is twice our advantage
+    int64_t lead      = channel->remote_tick ? (int64_t)(netplay->tick - channel->remote_tick) : 0;
+    int64_t advantage = (lead - channel->remote_lead) / 2;
+    if (netplay->tick >= channel->received_until + NETPLAY_MAX_ROLLBACK) {
+        netplay->stalls++;
+    } else if (advantage > NETPLAY_MAX_ADVANTAGE) {
+        netplay->waits++;
+    } else {
+        netplay->buttons[netplay->tick & (NETPLAY_HISTORY - 1)][netplay->local] = buttons;
+        channel_push(channel, buttons);
+        netplay_simulate(netplay, frame, rules, netplay->tick);
+        netplay->tick++;
+        channel_flush(channel, netplay->tick);
+        return true;
+    }
+    channel_flush(channel, netplay->tick);
+    return false;
+}
+
+// The second player of --netplay loopback: it has buttons for every tick the
+// local peer reached, they just arrive as late as the transport makes them.
+void loopback_peer_update(InputChannel *peer, uint64_t tick, uint8_t buttons)
+{
+    uint64_t first_new;
+    channel_receive(peer, &first_new);
+    while (peer->sent_until <= tick)
+        channel_push(peer, buttons);
+    channel_flush(peer, peer->sent_until);
+}
+
+//==========Latency==========//
+// Input to photon latency is the time from a key event until glfwSwapBuffers
+// returns for the first frame that shows its result. The simulation tags
+// snapshots with the oldest input that is not on screen yet and the render
+// thread measures it after the swap. A swap returning is the closest thing to
+// photons that we can see from here.
+#define LATENCY_BUCKET_NS 250000 // 0.25 ms
+#define LATENCY_BUCKETS   400    // up to 100 ms, the last bucket takes the rest
+
+typedef struct {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t samples;
+    int64_t max;
+} LatencyHistogram;
+
+void record_latency(LatencyHistogram *histogram, int64_t latency)
+{
+    size_t bucket = latency / LATENCY_BUCKET_NS;
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+    histogram->buckets[bucket]++;
+    histogram->samples++;
+    if (latency > histogram->max)
+        histogram->max = latency;
+}
+
+// upper edge of the bucket that holds the percentile, in ns
+int64_t latency_percentile(LatencyHistogram *histogram, double percentile)
+{
+    uint64_t wanted = (uint64_t)ceil(histogram->samples * percentile / 100.0);
+    uint64_t seen   = 0;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= wanted && seen > 0)
+            return (i + 1) * LATENCY_BUCKET_NS;
+    }
+    return histogram->max;
+}
+
+void print_latency(LatencyHistogram *histogram)
+{
+    if (histogram->samples == 0)
+        return;
+    printf("INFO : Input latency: %" PRIu64 " samples, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           histogram->samples,
+           latency_percentile(histogram, 50) / 1e6,
+           latency_percentile(histogram, 90) / 1e6,
+           latency_percentile(histogram, 99) / 1e6,
+           histogram->max / 1e6);
+}
+
+// presented_ticks is the tick of the newest snapshot on screen plus one
+void track_pending_input(Frame *frame, int64_t first_event_time, uint64_t presented_ticks)
+{
+    if (frame->pending_input_time && presented_ticks > frame->pending_input_tick)
+        frame->pending_input_time = 0;
+    if (!frame->pending_input_time && first_event_time) {
+        frame->pending_input_time = first_event_time;
+        frame->pending_input_tick = frame->tick;
+    }
+}
+
+//==========Snapshot==========//
+// Everything the render thread needs to draw one frame. The simulation writes
+// one slot, the render thread reads another and the third one holds the newest
+// finished snapshot, so neither side ever waits for the other.
+#define MAX_DRAW_ITEMS (MAX_PLAYERS + MAX_PLAYER_FIRES + MAX_ENEMY_FIRES + NUMBER_OF_ENEMIES)
+#define SNAPSHOT_FRESH 4u
+
+typedef struct {
+    Fixed x, y;
+    uint32_t sprite;
+    uint32_t color;
+} DrawItem;
+
+typedef struct {
+    uint64_t tick;
+    int64_t input_time; // oldest input whose result is in this snapshot, 0 if none
+    size_t number_of_items;
+    DrawItem items[MAX_DRAW_ITEMS]; // the first one is always the local player
+} Snapshot;
+
+typedef struct {
+    Snapshot slots[3];
+    atomic_uint ready; // slot of the newest snapshot, with SNAPSHOT_FRESH until it is taken
+    unsigned writing;  // only touched by the simulation
+    unsigned reading;  // only touched by the render thread
+    bool closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t published;
+} SnapshotMailbox;
+
+void init_mailbox(SnapshotMailbox *mailbox)
+{
+    mailbox->writing = 0;
+    mailbox->reading = 2;
+    mailbox->closed  = false;
+    atomic_init(&mailbox->ready, 1);
+    pthread_mutex_init(&mailbox->mutex, NULL);
+    pthread_cond_init(&mailbox->published, NULL);
+}
+
+void destroy_mailbox(SnapshotMailbox *mailbox)
+{
+    pthread_mutex_destroy(&mailbox->mutex);
+    pthread_cond_destroy(&mailbox->published);
+}
+
+static inline Snapshot *mailbox_write_slot(SnapshotMailbox *mailbox)
+{
+    return &mailbox->slots[mailbox->writing];
+}
+
+void mailbox_publish(SnapshotMailbox *mailbox)
+{
+    unsigned previous = atomic_exchange(&mailbox->ready, mailbox->writing | SNAPSHOT_FRESH);
+    mailbox->writing  = previous & ~SNAPSHOT_FRESH;
+    pthread_mutex_lock(&mailbox->mutex);
+    pthread_cond_signal(&mailbox->published);
+    pthread_mutex_unlock(&mailbox->mutex);
+}
+
+void mailbox_close(SnapshotMailbox *mailbox)
+{
+    pthread_mutex_lock(&mailbox->mutex);
+    mailbox->closed = true;
+    pthread_cond_broadcast(&mailbox->published);
+    pthread_mutex_unlock(&mailbox->mutex);
+}
+
+// blocks until a snapshot newer than the last one is published, NULL once the
+// mailbox is closed
+Snapshot *mailbox_wait(SnapshotMailbox *mailbox)
+{
+    pthread_mutex_lock(&mailbox->mutex);
+    while (!(atomic_load(&mailbox->ready) & SNAPSHOT_FRESH) && !mailbox->closed)
+        pthread_cond_wait(&mailbox->published, &mailbox->mutex);
+    bool closed = mailbox->closed;
+    pthread_mutex_unlock(&mailbox->mutex);
+    if (closed)
+        return NULL;
+    unsigned previous = atomic_exchange(&mailbox->ready, mailbox->reading);
+    mailbox->reading  = previous & ~SNAPSHOT_FRESH;
+    return &mailbox->slots[mailbox->reading];
+}
+
+static inline void push_draw_item(Snapshot *snapshot, Object *obj)
+{
+    // MAX_DRAW_ITEMS counts every object there can be, more is a bug
+    if (snapshot->number_of_items == MAX_DRAW_ITEMS) {
+        fprintf(stderr, "ERROR: A snapshot has room for only %d objects, the rest are not drawn\n", MAX_DRAW_ITEMS);
+#ifndef NDEBUG
+        abort();
+#endif
+        return;
+    }
+    DrawItem *item = &snapshot->items[snapshot->number_of_items++];
+    item->x        = obj->x;
+    item->y        = obj->y;
+    item->sprite   = obj->curr_sprite->id;
+    item->color    = obj->color;
+}
+
+// same order the objects used to be drawn in, later items are on top
+void take_snapshot(Snapshot *snapshot, Frame *frame)
+{
+    snapshot->tick            = frame->tick;
+    snapshot->input_time      = frame->pending_input_time;
+    snapshot->number_of_items = 0;
+    push_draw_item(snapshot, &PLAYERS[frame->local_player]);
+    for (size_t i = 0; i < NUMBER_OF_PLAYERS; i++) {
+        if (i != frame->local_player)
+            push_draw_item(snapshot, &PLAYERS[i]);
+    }
+    for (size_t i = 0; i < MAX_PLAYER_FIRES; i++) {
+        Object *fire = entity_get(&ENTITIES, player_fires[i]);
+        if (fire != NULL)
+            push_draw_item(snapshot, fire);
+    }
+    for (size_t i = 0; i < MAX_ENEMY_FIRES; i++) {
+        Object *fire = entity_get(&ENTITIES, enemy_fires[i]);
+        if (fire != NULL)
+            push_draw_item(snapshot, fire);
+    }
+    for (size_t i = 0; i < NUMBER_OF_ENEMIES; i++) {
+        Object *enemy = entity_get(&ENTITIES, frame_enemy(frame, i));
+        if (enemy != NULL)
+            push_draw_item(snapshot, enemy);
+    }
+}
+
+//==========Server==========//
+// --server <port> runs the game without a window for thin clients that come
+// in with --connect <host>:<port>. The server is authoritative: clients only
+// send their buttons and draw what they get back. Every NET_SEND_INTERVAL
+// ticks the server quantizes what there is to draw to whole pixels in a
+// NetState and sends each client the XOR delta to the newest state that
+// client acknowledged, run length encoded like the rewind buffer. Objects
+// that are gone are all zeros, so mostly only the moving ones are sent.
+// Clients that acknowledged the same state get the same packet, which is
+// encoded only once.
+// The first MAX_PLAYERS clients play, everybody after them watches.
+// --bots <n> together with --connect runs n clients without a window that
+// press random buttons, to see how many clients one machine can serve.
+#define NET_SEND_INTERVAL  16 // ticks between states sent to clients
+#define NET_HISTORY        32 // states both sides keep for deltas
+#define NET_MAX_PACKET     4096
+#define NET_MAX_CLIENTS    1024
+#define NET_CLIENT_TIMEOUT (5 * (int64_t)1000000000)
+#define NET_STATS_INTERVAL (5 * (int64_t)1000000000)
+#define NET_NO_STATE       UINT64_MAX
+#define NET_STATE_MAGIC    0x4E535453 // "STSN"
+#define NET_INPUT_MAGIC    0x4E504E49 // "INPN"
+#define NET_OBJECTS        (MAX_PLAYERS + MAX_PLAYER_FIRES + MAX_ENEMY_FIRES + NUMBER_OF_ENEMIES)
+
+// every byte that means nothing stays zero, deltas see every byte
+typedef struct {
+    uint32_t color;
+    int16_t x, y; // whole pixels
+    uint8_t sprite;
+    uint8_t unused[3];
+} NetObject;
+
+typedef struct {
+    uint64_t score;
+    uint32_t wave;
+    uint8_t alive[(NET_OBJECTS + 31) / 32 * 4]; // bit per object
+    NetObject objects[NET_OBJECTS]; // players, player fires, enemy fires, enemies, in drawing order
+} NetState;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t length; // of the delta after the header
+    uint64_t tick;
+    uint64_t baseline; // the state the delta is to, NET_NO_STATE for all zeros
+} StatePacketHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t buttons;
+    uint8_t unused[3];
+    uint64_t ack; // newest state the client has, NET_NO_STATE for none
+} InputPacket;
+
+typedef struct {
+    struct sockaddr_in address;
+    int64_t last_heard;
+    uint64_t ack;
+    int player; // -1 watches
+} ServerClient;
+
+typedef struct {
+    int socket;
+    ServerClient clients[NET_MAX_CLIENTS];
+    size_t number_of_clients;
+    uint8_t buttons[MAX_PLAYERS];
+    NetState *history;            // NET_HISTORY states
+    uint64_t ticks[NET_HISTORY];  // of the states in history
+    uint8_t *packets;             // NET_HISTORY + 1 packets of NET_MAX_PACKET, by baseline
+    size_t packet_sizes[NET_HISTORY + 1];
+    uint64_t ticks_run, states_sent, packets_encoded;
+    uint64_t bytes_sent, packets_sent, client_seconds; // client_seconds in NET_STATS_INTERVAL units
+    int64_t tick_time, encode_time;                     // ns
+} Server;
+
+static Server SERVER;
+static volatile sig_atomic_t NET_QUIT;
+
+static void net_quit(int signal)
+{
+    NET_QUIT = 1;
+}
+
+static inline size_t net_slot(uint64_t tick)
+{
+    return tick / NET_SEND_INTERVAL % NET_HISTORY;
+}
+
+static void capture_net_object(NetState *state, size_t index, Object *object)
+{
+    if (!object)
+        return;
+    NetObject *net = &state->objects[index];
+    net->color     = object->color;
+    net->x         = (int16_t)fixed_to_int(object->x);
+    net->y         = (int16_t)fixed_to_int(object->y);
+    net->sprite    = (uint8_t)object->curr_sprite->id;
+    state->alive[index / 8] |= 1 << (index % 8);
+}
+
+void capture_net_state(NetState *state, Frame *frame, Rules *rules)
+{
+    memset(state, 0, sizeof(*state));
+    state->score = rules->score;
+    state->wave  = rules->wave;
+    size_t index = 0;
+    for (size_t i = 0; i < MAX_PLAYERS; i++, index++)
+        capture_net_object(state, index, i < NUMBER_OF_PLAYERS ? &PLAYERS[i] : NULL);
+    for (size_t i = 0; i < MAX_PLAYER_FIRES; i++, index++)
+        capture_net_object(state, index, entity_get(&ENTITIES, player_fires[i]));
+    for (size_t i = 0; i < MAX_ENEMY_FIRES; i++, index++)
+        capture_net_object(state, index, entity_get(&ENTITIES, enemy_fires[i]));
+    for (size_t i = 0; i < NUMBER_OF_ENEMIES; i++, index++)
+        capture_net_object(state, index, entity_get(&ENTITIES, frame_enemy(frame, i)));
+}
+
+bool start_server(Server *server, const char *port)
+{
+    *server         = (Server){ 0 };
+    server->history = memory_calloc(MEMORY_NETPLAY, NET_HISTORY, sizeof(NetState));
+    server->packets = memory_alloc(MEMORY_NETPLAY, (NET_HISTORY + 1) * NET_MAX_PACKET);
+    if (!server->history || !server->packets) {
+        fprintf(stderr, "ERROR: Could not malloc memory for the server. Please buy more RAM!\n");
+        return false;
+    }
+    for (size_t i = 0; i < NET_HISTORY; i++)
+        server->ticks[i] = NET_NO_STATE;
+    server->socket = open_udp_socket(port);
+    if (server->socket < 0)
+        return false;
+    printf("INFO : Server waiting for clients on UDP port %s\n", port);
+    return true;
+}
+
+void stop_server(Server *server)
+{
+    if (server->ticks_run) {
+        printf("INFO : Server ran %" PRIu64 " ticks, %.2f us per tick, sent %" PRIu64 " states in %" PRIu64 " packets of %.0f bytes\n",
+               server->ticks_run, server->tick_time / 1e3 / server->ticks_run, server->states_sent, server->packets_sent,
+               server->packets_sent ? (double)server->bytes_sent / server->packets_sent : 0.0);
+    }
+    if (server->socket > 0)
+        close(server->socket);
+    memory_free(server->history);
+    memory_free(server->packets);
+    *server = (Server){ 0 };
+}
+
+static ServerClient *find_server_client(Server *server, struct sockaddr_in *address, int64_t now)
+{
+    for (size_t i = 0; i < server->number_of_clients; i++) {
+        ServerClient *client = &server->clients[i];
+        if (client->address.sin_addr.s_addr == address->sin_addr.s_addr && client->address.sin_port == address->sin_port)
+            return client;
+    }
+    if (server->number_of_clients == NET_MAX_CLIENTS)
+        return NULL;
+
+    ServerClient *client = &server->clients[server->number_of_clients++];
+    *client              = (ServerClient){ .address = *address, .last_heard = now, .ack = NET_NO_STATE, .player = -1 };
+    bool taken[MAX_PLAYERS] = { 0 };
+    for (size_t i = 0; i + 1 < server->number_of_clients; i++) {
+        if (server->clients[i].player >= 0)
+            taken[server->clients[i].player] = true;
+    }
+    for (int i = 0; i < MAX_PLAYERS && client->player < 0; i++) {
+        if (!taken[i])
+            client->player = i;
+    }
+    printf("INFO : %s:%d joined as %s\n", inet_ntoa(address->sin_addr), ntohs(address->sin_port), client->player >= 0 ? "a player" : "a spectator");
+    return client;
+}
+
+void server_receive(Server *server)
+{
+    int64_t now = now_ns();
+    InputPacket packet;
+    struct sockaddr_in from;
+    socklen_t length = sizeof(from);
+    ssize_t size;
+    while ((size = recvfrom(server->socket, &packet, sizeof(packet), 0, (struct sockaddr *)&from, &length)) > 0) {
+        length = sizeof(from);
+        if (size != sizeof(packet) || packet.magic != NET_INPUT_MAGIC)
+            continue;
+        ServerClient *client = find_server_client(server, &from, now);
+        if (!client)
+            continue;
+        client->last_heard = now;
+        if (packet.ack != NET_NO_STATE && (client->ack == NET_NO_STATE || packet.ack > client->ack))
+            client->ack = packet.ack;
+        if (client->player >= 0)
+            server->buttons[client->player] = packet.buttons;
+    }
+
+    // swap remove, a player who left lets go of the buttons
+    for (size_t i = 0; i < server->number_of_clients;) {
+        ServerClient *client = &server->clients[i];
+        if (now - client->last_heard < NET_CLIENT_TIMEOUT) {
+            i++;
+            continue;
+        }
+        printf("INFO : %s:%d left\n", inet_ntoa(client->address.sin_addr), ntohs(client->address.sin_port));
+        if (client->player >= 0)
+            server->buttons[client->player] = 0;
+        *client = server->clients[--server->number_of_clients];
+    }
+}
+
+// the packet for clients that have the state baseline, encoded the first time it is asked for
+static size_t server_packet(Server *server, uint64_t tick, uint64_t baseline, uint8_t **packet)
+{
+    static const NetState EMPTY = { 0 };
+    size_t slot                 = net_slot(baseline);
+    if (baseline == NET_NO_STATE || server->ticks[slot] != baseline || baseline >= tick)
+        slot = NET_HISTORY;
+    *packet = server->packets + slot * NET_MAX_PACKET;
+    if (server->packet_sizes[slot])
+        return server->packet_sizes[slot];
+
+    const NetState *from     = slot == NET_HISTORY ? &EMPTY : &server->history[slot];
+    StatePacketHeader header = { .magic = NET_STATE_MAGIC, .tick = tick, .baseline = slot == NET_HISTORY ? NET_NO_STATE : baseline };
+    header.length            = (uint32_t)encode_delta((const uint8_t *)from, (const uint8_t *)&server->history[net_slot(tick)], sizeof(NetState),
+                                                      *packet + sizeof(header));
+    memcpy(*packet, &header, sizeof(header));
+    server->packet_sizes[slot] = sizeof(header) + header.length;
+    server->packets_encoded++;
+    return server->packet_sizes[slot];
+}
+
+void server_broadcast(Server *server, Frame *frame, Rules *rules, uint64_t tick)
+{
+    int64_t start = now_ns();
+    size_t slot   = net_slot(tick);
+    capture_net_state(&server->history[slot], frame, rules);
+    server->ticks[slot] = tick;
+    memset(server->packet_sizes, 0, sizeof(server->packet_sizes));
+    for (size_t i = 0; i < server->number_of_clients; i++) {
+        ServerClient *client = &server->clients[i];
+        uint8_t *packet;
+        size_t size = server_packet(server, tick, client->ack, &packet);
+        if (sendto(server->socket, packet, size, 0, (struct sockaddr *)&client->address, sizeof(client->address)) == (ssize_t)size) {
+            server->bytes_sent += size;
+            server->packets_sent++;
+        }
+    }
+    server->states_sent++;
+    server->encode_time += now_ns() - start;
+}
+
+// Simulates at SIMULATION_RATE until SIGINT, or as fast as it can with
+// --uncapped to see how many matches fit on the machine.
+void run_server(Server *server, Frame *frame, Rules *rules)
+{
+    signal(SIGINT, net_quit);
+    signal(SIGTERM, net_quit);
+    int64_t next_tick   = CLOCK.real_time;
+    int64_t stats_start = now_ns();
+    uint64_t stats_ticks = 0, stats_bytes = 0, stats_states = 0;
+    int64_t stats_tick_time = 0, stats_encode_time = 0;
+    while (!NET_QUIT) {
+        int64_t start = now_ns();
+        arena_reset(&FRAME_ARENA);
+        frame_clock_tick(&CLOCK);
+        server_receive(server);
+        simulate_tick(frame, server->buttons);
+        frame->tick++;
+        if (frame->tick % NET_SEND_INTERVAL == 0)
+            server_broadcast(server, frame, rules, frame->tick);
+        server->ticks_run++;
+        server->tick_time += now_ns() - start;
+
+        if (start - stats_start >= NET_STATS_INTERVAL) {
+            double seconds  = (start - stats_start) / 1e9;
+            uint64_t ticks  = server->ticks_run - stats_ticks;
+            size_t clients  = server->number_of_clients;
+            printf("INFO : Server %.0f ticks/s, %.2f us per tick, %.2f us per state sent, %zu clients, %.1f KB/s per client\n",
+                   ticks / seconds, (server->tick_time - stats_tick_time) / 1e3 / ticks,
+                   (server->encode_time - stats_encode_time) / 1e3 / (server->states_sent - stats_states),
+                   clients, clients ? (server->bytes_sent - stats_bytes) / 1024.0 / seconds / clients : 0.0);
+            stats_start       = start;
+            stats_ticks       = server->ticks_run;
+            stats_bytes       = server->bytes_sent;
+            stats_states      = server->states_sent;
+            stats_tick_time   = server->tick_time;
+            stats_encode_time = server->encode_time;
+        }
+        if (CONFIG.pacing == PACING_UNCAPPED)
+            continue;
+        next_tick += frame_clock_interval(&CLOCK);
+        int64_t now = now_ns();
+        if (now - next_tick > PACING_MAX_LAG)
+            next_tick = now;
+        precise_wait_until(next_tick);
+    }
+}
+
+//==========Thin Client==========//
+// The other end of --server: keeps the states it got so the server can send
+// deltas to any of them, and draws between the two newest ones. That shows
+// everything one send interval late but moves smoothly at any frame rate.
+typedef struct {
+    int socket;
+    NetState states[NET_HISTORY];
+    uint64_t ticks[NET_HISTORY];
+    uint64_t latest, previous; // ticks of the two newest states, NET_NO_STATE if there are none
+    int64_t latest_time;       // when the newest state came
+    uint8_t buttons;
+    uint64_t bytes, received, broken; // broken packets or deltas to states we do not have
+    int64_t decode_time;              // ns
+} NetClient;
+
+static NetClient NET_CLIENT;
+
+void net_client_send(NetClient *client)
+{
+    InputPacket packet = { .magic = NET_INPUT_MAGIC, .buttons = client->buttons, .ack = client->latest };
+    send(client->socket, &packet, sizeof(packet), 0);
+}
+
+// says hello to the server, which takes us in when it hears from us
+bool connect_net_client(NetClient *client, const char *address)
+{
+    struct sockaddr_in server;
+    if (!resolve_address(address, &server))
+        return false;
+    client->socket = open_udp_socket(NULL);
+    if (client->socket < 0)
+        return false;
+    // a connected UDP socket only hears from the server
+    if (connect(client->socket, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        fprintf(stderr, "ERROR: Could not connect to %s: %s\n", address, strerror(errno));
+        close(client->socket);
+        return false;
+    }
+    client->latest = client->previous = NET_NO_STATE;
+    for (size_t i = 0; i < NET_HISTORY; i++)
+        client->ticks[i] = NET_NO_STATE;
+    net_client_send(client);
+    return true;
+}
+
+static bool net_client_decode(NetClient *client, const uint8_t *packet, size_t size)
+{
+    StatePacketHeader header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, packet, sizeof(header));
+    if (header.magic != NET_STATE_MAGIC || header.length != size - sizeof(header) || header.tick % NET_SEND_INTERVAL)
+        return false;
+    if (client->latest != NET_NO_STATE && header.tick <= client->latest)
+        return true; // late, we have something newer
+
+    NetState state = { 0 };
+    if (header.baseline != NET_NO_STATE) {
+        size_t slot = net_slot(header.baseline);
+        if (client->ticks[slot] != header.baseline)
+            return false;
+        state = client->states[slot];
+    }
+    if (!apply_delta((uint8_t *)&state, sizeof(state), packet + sizeof(header), header.length))
+        return false;
+    size_t slot          = net_slot(header.tick);
+    client->states[slot] = state;
+    client->ticks[slot]  = header.tick;
+    client->previous     = client->latest;
+    client->latest       = header.tick;
+    client->latest_time  = now_ns();
+    return true;
+}
+
+// takes in every packet that came and acknowledges the newest state
+void net_client_receive(NetClient *client)
+{
+    uint8_t packet[NET_MAX_PACKET];
+    ssize_t size;
+    bool any = false;
+    while ((size = recv(client->socket, packet, sizeof(packet), 0)) > 0) {
+        int64_t start = now_ns();
+        client->bytes += size;
+        client->received++;
+        if (net_client_decode(client, packet, size))
+            any = true;
+        else
+            client->broken++;
+        client->decode_time += now_ns() - start;
+    }
+    if (any)
+        net_client_send(client);
+}
+
+void close_net_client(NetClient *client)
+{
+    if (client->received)
+        printf("INFO : Received %" PRIu64 " states, %.0f bytes each, %" PRIu64 " broken\n", client->received,
+               (double)client->bytes / client->received, client->broken);
+    close(client->socket);
+}
+
+static inline bool net_alive(const NetState *state, size_t index)
+{
+    return state->alive[index / 8] & (1 << (index % 8));
+}
+
+// Objects that were there in both states move between them, unless they
+// jumped (a fire slot that was used again).
+void take_net_snapshot(Snapshot *snapshot, NetClient *client, Frame *frame)
+{
+    snapshot->tick            = frame->tick;
+    snapshot->input_time      = frame->pending_input_time;
+    snapshot->number_of_items = 0;
+    if (client->latest == NET_NO_STATE)
+        return;
+    const NetState *latest   = &client->states[net_slot(client->latest)];
+    const NetState *previous = client->previous != NET_NO_STATE ? &client->states[net_slot(client->previous)] : latest;
+    double t                 = (now_ns() - client->latest_time) * (SIMULATION_RATE / 1e9) / NET_SEND_INTERVAL;
+    if (t > 1)
+        t = 1;
+    for (size_t i = 0; i < NET_OBJECTS; i++) {
+        if (!net_alive(latest, i))
+            continue;
+        const NetObject *to   = &latest->objects[i];
+        const NetObject *from = net_alive(previous, i) ? &previous->objects[i] : to;
+        if (abs(to->x - from->x) > 32 || abs(to->y - from->y) > 32)
+            from = to;
+        DrawItem *item = &snapshot->items[snapshot->number_of_items++];
+        item->x        = int_to_fixed(from->x) + (Fixed)((to->x - from->x) * t * FIXED_ONE);
+        item->y        = int_to_fixed(from->y) + (Fixed)((to->y - from->y) * t * FIXED_ONE);
+        item->sprite   = to->sprite;
+        item->color    = to->color;
+    }
+}
+
+// Load generator for --server, one socket per bot. Stops on SIGINT.
+bool run_bots(const char *address, size_t number_of_bots)
+{
+    NetClient *bots = memory_calloc(MEMORY_NETPLAY, number_of_bots, sizeof(NetClient));
+    if (!bots) {
+        fprintf(stderr, "ERROR: Could not malloc memory for %zu bots. Please buy more RAM!\n", number_of_bots);
+        return false;
+    }
+    for (size_t i = 0; i < number_of_bots; i++) {
+        if (!connect_net_client(&bots[i], address))
+            return false;
+    }
+    printf("INFO : %zu bots connected to %s\n", number_of_bots, address);
+
+    signal(SIGINT, net_quit);
+    signal(SIGTERM, net_quit);
+    uint64_t random     = 0x9E3779B97F4A7C15;
+    int64_t next_tick   = now_ns();
+    int64_t stats_start = next_tick;
+    uint64_t stats_bytes = 0, stats_received = 0;
+    for (uint64_t tick = 0; !NET_QUIT; tick++) {
+        for (size_t i = 0; i < number_of_bots; i++) {
+            NetClient *bot = &bots[i];
+            net_client_receive(bot);
+            // new buttons about twice a second, a keep alive when nothing came
+            if ((tick + i) % (SIMULATION_RATE / 2) == 0) {
+                random ^= random >> 12;
+                random ^= random << 25;
+                random ^= random >> 27;
+                bot->buttons = (uint8_t)((random * 0x2545F4914F6CDD1D) >> 61);
+                net_client_send(bot);
+            }
+        }
+
+        int64_t now = now_ns();
+        if (now - stats_start >= NET_STATS_INTERVAL) {
+            uint64_t bytes = 0, received = 0, broken = 0;
+            int64_t decode_time = 0;
+            for (size_t i = 0; i < number_of_bots; i++) {
+                bytes += bots[i].bytes;
+                received += bots[i].received;
+                broken += bots[i].broken;
+                decode_time += bots[i].decode_time;
+            }
+            double seconds = (now - stats_start) / 1e9;
+            printf("INFO : %zu bots, %.1f KB/s and %.1f states/s per bot, %.2f us per decode, %" PRIu64 " broken\n", number_of_bots,
+                   (bytes - stats_bytes) / 1024.0 / seconds / number_of_bots, (received - stats_received) / seconds / number_of_bots,
+                   received ? decode_time / 1e3 / received : 0.0, broken);
+            stats_start    = now;
+            stats_bytes    = bytes;
+            stats_received = received;
+        }
+        next_tick += 1000000000 / SIMULATION_RATE;
+        if (now - next_tick > PACING_MAX_LAG)
+            next_tick = now;
+        precise_wait_until(next_tick);
+    }
+
+    for (size_t i = 0; i < number_of_bots; i++)
+        close(bots[i].socket);
+    memory_free(bots);
+    return true;
+}
+
+//==========Spectator==========//
+// --spectate <port> streams the framebuffer to any number of viewers over TCP,
+// or over a Unix socket when the argument is a path. After rasterizing, the
+// render thread compares every tile with what the viewers already have and
+// encodes only the changed ones. A tile with few colors becomes a palette
+// and runs of palette indices, any other tile is sent raw. The comparison
+// and the run search do four pixels at a time with SSE2.
+// A thread of its own accepts viewers and writes to them. Every viewer has a
+// short queue of frames. A viewer that does not keep up gets no new frames
+// until its queue has room again and then waits for a key frame, which has
+// every tile, because the frames in between only make sense after the ones
+// it did not get.
+//
+// On the wire a frame is a SpectatorHeader and then, for every tile, its
+// index (u16) and the number of palette colors (u8). With 0 colors the tile
+// is SPECTATOR_TILE_PIXELS raw colors, otherwise the palette colors follow
+// and then (palette index, run length - 1) byte pairs until the tile is
+// full. Pixels of a tile go row by row, colors are RGBA in host byte order.
+#define SPECTATOR_TILE        16
+#define SPECTATOR_TILE_PIXELS (SPECTATOR_TILE * SPECTATOR_TILE)
+#define SPECTATOR_TILES_X     (WINDOW_WIDTH / SPECTATOR_TILE)
+#define SPECTATOR_TILES       (SPECTATOR_TILES_X * (WINDOW_HEIGHT / SPECTATOR_TILE))
+#define SPECTATOR_MAX_PALETTE 16
+#define SPECTATOR_MAX_FRAME   (sizeof(SpectatorHeader) + SPECTATOR_TILES * (3 + SPECTATOR_TILE_PIXELS * sizeof(uint32_t)))
+#define SPECTATOR_MAX_VIEWERS 64
+#define SPECTATOR_QUEUE       4 // frames per viewer
+#define SPECTATOR_PENDING     8 // frames the spectator thread did not take yet
+#define SPECTATOR_MAGIC       0x43455053 // "SPEC"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size; // of the tiles after the header
+    uint64_t frame;
+    uint16_t tiles;
+    uint8_t keyframe;
+    uint8_t unused[5];
+} SpectatorHeader;
+
+typedef struct {
+    int references; // viewer queues it is in, only the spectator thread touches it
+    size_t size;    // header included
+    bool keyframe;
+    uint8_t data[];
+} SpectatorFrame;
+
+typedef struct {
+    int socket;
+    SpectatorFrame *queue[SPECTATOR_QUEUE];
+    size_t first, count;
+    size_t written; // bytes of the first frame in the queue
+    bool waiting_for_keyframe;
+} Viewer;
+
+typedef struct {
+    // render thread
+    uint32_t *previous; // the framebuffer as the viewers have it
+    uint8_t *encoded;   // SPECTATOR_MAX_FRAME
+    uint64_t frames, keyframes, bytes;
+    int64_t encode_time; // ns
+    // from the render thread to the spectator thread
+    SpectatorFrame *pending[SPECTATOR_PENDING];
+    size_t first_pending, number_of_pending;
+    pthread_mutex_t mutex;
+    int wake[2]; // pipe, the render thread writes a byte for every frame
+    atomic_bool keyframe_wanted;
+    atomic_int number_of_viewers;
+    // spectator thread
+    int listener;
+    Viewer viewers[SPECTATOR_MAX_VIEWERS];
+    uint64_t dropped; // frames a viewer did not get
+    atomic_bool running;
+    pthread_t thread;
+} Spectators;
+
+static Spectators SPECTATORS;
+
+#ifdef __SSE2__
+static inline bool tile_row_equal(const uint32_t *a, const uint32_t *b)
+{
+    __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)a), _mm_loadu_si128((const __m128i *)b));
+    for (size_t i = 4; i < SPECTATOR_TILE; i += 4)
+        equal = _mm_and_si128(equal, _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+    return _mm_movemask_epi8(equal) == 0xFFFF;
+}
+
+// pixels from start on that have its color, up to end
+static inline size_t run_length(const uint32_t *pixels, size_t start, size_t end)
+{
+    __m128i color = _mm_set1_epi32((int)pixels[start]);
+    size_t i      = start + 1;
+    for (; i + 4 <= end; i += 4) {
+        int equal = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)(pixels + i)), color)));
+        if (equal != 0xF)
+            return i + __builtin_ctz(~equal) - start;
+    }
+    while (i < end && pixels[i] == pixels[start])
+        i++;
+    return i - start;
+}
+#else
+static inline bool tile_row_equal(const uint32_t *a, const uint32_t *b)
+{
+    return memcmp(a, b, SPECTATOR_TILE * sizeof(uint32_t)) == 0;
+}
+
+static inline size_t run_length(const uint32_t *pixels, size_t start, size_t end)
+{
+    size_t i = start + 1;
+    while (i < end && pixels[i] == pixels[start])
+        i++;
+    return i - start;
+}
+#endif
+
+// Copies the tile to pixels and to previous, true if it changed.
+static bool take_tile(const uint32_t *framebuffer, uint32_t *previous, size_t index, uint32_t *pixels, bool keyframe)
+{
+    size_t offset = (index / SPECTATOR_TILES_X) * SPECTATOR_TILE * WINDOW_WIDTH + (index % SPECTATOR_TILES_X) * SPECTATOR_TILE;
+    bool changed  = keyframe;
+    for (size_t y = 0; y < SPECTATOR_TILE && !changed; y++)
+        changed = !tile_row_equal(framebuffer + offset + y * WINDOW_WIDTH, previous + offset + y * WINDOW_WIDTH);
+    if (!changed)
+        return false;
+    for (size_t y = 0; y < SPECTATOR_TILE; y++) {
+        memcpy(pixels + y * SPECTATOR_TILE, framebuffer + offset + y * WINDOW_WIDTH, SPECTATOR_TILE * sizeof(uint32_t));
+        memcpy(previous + offset + y * WINDOW_WIDTH, pixels + y * SPECTATOR_TILE, SPECTATOR_TILE * sizeof(uint32_t));
+    }
+    return true;
+}
+
+// returns the bytes written to out
+static size_t encode_tile(const uint32_t *pixels, size_t index, uint8_t *out)
+{
+    uint32_t palette[SPECTATOR_MAX_PALETTE];
+    uint8_t runs[SPECTATOR_TILE_PIXELS * 2];
+    size_t number_of_colors = 0, number_of_runs = 0;
+    for (size_t i = 0; i < SPECTATOR_TILE_PIXELS;) {
+        size_t color = 0;
+        while (color < number_of_colors && palette[color] != pixels[i])
+            color++;
+        if (color == number_of_colors) {
+            if (number_of_colors == SPECTATOR_MAX_PALETTE)
+                break;
+            palette[number_of_colors++] = pixels[i];
+        }
+        size_t length = run_length(pixels, i, i + 256 < SPECTATOR_TILE_PIXELS ? i + 256 : SPECTATOR_TILE_PIXELS);
+        runs[number_of_runs * 2]     = (uint8_t)color;
+        runs[number_of_runs * 2 + 1] = (uint8_t)(length - 1);
+        number_of_runs++;
+        i += length;
+    }
+
+    uint16_t tile = (uint16_t)index;
+    memcpy(out, &tile, sizeof(tile));
+    size_t palette_size = number_of_colors * sizeof(uint32_t) + number_of_runs * 2;
+    size_t covered      = 0;
+    for (size_t i = 0; i < number_of_runs; i++)
+        covered += runs[i * 2 + 1] + 1;
+    if (covered < SPECTATOR_TILE_PIXELS || palette_size >= SPECTATOR_TILE_PIXELS * sizeof(uint32_t)) {
+        out[2] = 0;
+        memcpy(out + 3, pixels, SPECTATOR_TILE_PIXELS * sizeof(uint32_t));
+        return 3 + SPECTATOR_TILE_PIXELS * sizeof(uint32_t);
+    }
+    out[2] = (uint8_t)number_of_colors;
+    memcpy(out + 3, palette, number_of_colors * sizeof(uint32_t));
+    memcpy(out + 3 + number_of_colors * sizeof(uint32_t), runs, number_of_runs * 2);
+    return 3 + palette_size;
+}
+
+// Called by the render thread with every finished frame.
+void spectator_frame(Spectators *spectators, const uint32_t *framebuffer)
+{
+    if (atomic_load(&spectators->number_of_viewers) == 0)
+        return;
+    int64_t start = now_ns();
+    bool keyframe = atomic_exchange(&spectators->keyframe_wanted, false);
+    uint32_t pixels[SPECTATOR_TILE_PIXELS];
+    size_t size = sizeof(SpectatorHeader), tiles = 0;
+    for (size_t i = 0; i < SPECTATOR_TILES; i++) {
+        if (take_tile(framebuffer, spectators->previous, i, pixels, keyframe)) {
+            size += encode_tile(pixels, i, spectators->encoded + size);
+            tiles++;
+        }
+    }
+    SpectatorHeader header = {
+        .magic    = SPECTATOR_MAGIC,
+        .size     = (uint32_t)(size - sizeof(SpectatorHeader)),
+        .frame    = spectators->frames,
+        .tiles    = (uint16_t)tiles,
+        .keyframe = keyframe,
+    };
+    memcpy(spectators->encoded, &header, sizeof(header));
+
+    SpectatorFrame *frame = memory_alloc(MEMORY_SPECTATOR, sizeof(SpectatorFrame) + size);
+    bool queued           = false;
+    if (frame) {
+        *frame = (SpectatorFrame){ .size = size, .keyframe = keyframe };
+        memcpy(frame->data, spectators->encoded, size);
+        pthread_mutex_lock(&spectators->mutex);
+        if (spectators->number_of_pending < SPECTATOR_PENDING) {
+            spectators->pending[(spectators->first_pending + spectators->number_of_pending++) % SPECTATOR_PENDING] = frame;
+            queued = true;
+        }
+        pthread_mutex_unlock(&spectators->mutex);
+    }
+    if (queued) {
+        ssize_t written = write(spectators->wake[1], "", 1);
+        (void)written; // a full pipe already wakes the thread
+    } else {
+        // the change is lost for everybody, the next frame has every tile
+        memory_free(frame);
+        atomic_store(&spectators->keyframe_wanted, true);
+    }
+
+    spectators->frames++;
+    spectators->keyframes += keyframe;
+    spectators->bytes += size;
+    spectators->encode_time += now_ns() - start;
+}
+
+static void release_spectator_frame(SpectatorFrame *frame)
+{
+    if (--frame->references <= 0)
+        memory_free(frame);
+}
+
+static void remove_viewer(Spectators *spectators, size_t index)
+{
+    Viewer *viewer = &spectators->viewers[index];
+    close(viewer->socket);
+    for (size_t i = 0; i < viewer->count; i++)
+        release_spectator_frame(viewer->queue[(viewer->first + i) % SPECTATOR_QUEUE]);
+    int remaining = atomic_fetch_sub(&spectators->number_of_viewers, 1) - 1;
+    *viewer       = spectators->viewers[remaining];
+}
+
+static void add_viewer(Spectators *spectators)
+{
+    int fd = accept(spectators->listener, NULL, NULL);
+    if (fd < 0)
+        return;
+    int count = atomic_load(&spectators->number_of_viewers);
+    if (count == SPECTATOR_MAX_VIEWERS) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    spectators->viewers[count] = (Viewer){ .socket = fd, .waiting_for_keyframe = true };
+    atomic_store(&spectators->number_of_viewers, count + 1);
+}
+
+// Queues the frame for every viewer that has room and can use it. A viewer
+// that is waiting asks for a key frame once its queue is empty, see
+// spectator_thread_main(), asking earlier would only make every frame a key
+// frame for everybody while it is stuck.
+static void distribute_frame(Spectators *spectators, SpectatorFrame *frame)
+{
+    int count = atomic_load(&spectators->number_of_viewers);
+    for (int i = 0; i < count; i++) {
+        Viewer *viewer = &spectators->viewers[i];
+        if (viewer->count == SPECTATOR_QUEUE)
+            viewer->waiting_for_keyframe = true;
+        if (viewer->waiting_for_keyframe && (!frame->keyframe || viewer->count == SPECTATOR_QUEUE)) {
+            spectators->dropped++;
+            continue;
+        }
+        viewer->waiting_for_keyframe = false;
+        viewer->queue[(viewer->first + viewer->count++) % SPECTATOR_QUEUE] = frame;
+        frame->references++;
+    }
+    if (frame->references == 0)
+        memory_free(frame);
+}
+
+// false if the viewer is gone
+static bool write_to_viewer(Viewer *viewer)
+{
+    while (viewer->count) {
+        SpectatorFrame *frame = viewer->queue[viewer->first];
+        ssize_t written       = send(viewer->socket, frame->data + viewer->written, frame->size - viewer->written, MSG_NOSIGNAL);
+        if (written < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        viewer->written += written;
+        if (viewer->written < frame->size)
+            return true;
+        release_spectator_frame(frame);
+        viewer->first   = (viewer->first + 1) % SPECTATOR_QUEUE;
+        viewer->written = 0;
+        viewer->count--;
+    }
+    return true;
+}
+
+void *spectator_thread_main(void *arg)
+{
+    Spectators *spectators = arg;
+    struct pollfd fds[2 + SPECTATOR_MAX_VIEWERS];
+    while (atomic_load(&spectators->running)) {
+        int count = atomic_load(&spectators->number_of_viewers);
+        fds[0]    = (struct pollfd){ .fd = spectators->wake[0], .events = POLLIN };
+        fds[1]    = (struct pollfd){ .fd = spectators->listener, .events = POLLIN };
+        for (int i = 0; i < count; i++)
+            fds[2 + i] = (struct pollfd){ .fd = spectators->viewers[i].socket, .events = spectators->viewers[i].count ? POLLOUT : 0 };
+        if (poll(fds, 2 + count, 100) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN) {
+            char bytes[64];
+            while (read(spectators->wake[0], bytes, sizeof(bytes)) == sizeof(bytes))
+                ;
+            for (;;) {
+                SpectatorFrame *frame = NULL;
+                pthread_mutex_lock(&spectators->mutex);
+                if (spectators->number_of_pending) {
+                    frame                     = spectators->pending[spectators->first_pending];
+                    spectators->first_pending = (spectators->first_pending + 1) % SPECTATOR_PENDING;
+                    spectators->number_of_pending--;
+                }
+                pthread_mutex_unlock(&spectators->mutex);
+                if (!frame)
+                    break;
+                distribute_frame(spectators, frame);
+            }
+        }
+        // backwards, removing swaps the last viewer in
+        for (int i = count - 1; i >= 0; i--) {
+            Viewer *viewer = &spectators->viewers[i];
+            bool gone      = fds[2 + i].revents & (POLLERR | POLLHUP | POLLNVAL);
+            if (gone || !write_to_viewer(viewer))
+                remove_viewer(spectators, i);
+            else if (viewer->waiting_for_keyframe && viewer->count == 0)
+                atomic_store(&spectators->keyframe_wanted, true);
+        }
+        if (fds[1].revents & POLLIN)
+            add_viewer(spectators);
+    }
+    return NULL;
+}
+
+// address is a TCP port, or the path of a Unix socket if it has a '/'
+bool start_spectators(Spectators *spectators, const char *address)
+{
+    spectators->previous = memory_calloc(MEMORY_SPECTATOR, WINDOW_WIDTH * WINDOW_HEIGHT, sizeof(uint32_t));
+    spectators->encoded  = memory_alloc(MEMORY_SPECTATOR, SPECTATOR_MAX_FRAME);
+    if (!spectators->previous || !spectators->encoded) {
+        fprintf(stderr, "ERROR: Could not malloc memory for spectators. Please buy more RAM!\n");
+        return false;
+    }
+    if (pipe(spectators->wake) < 0) {
+        fprintf(stderr, "ERROR: Could not create a pipe: %s\n", strerror(errno));
+        return false;
+    }
+    fcntl(spectators->wake[0], F_SETFL, fcntl(spectators->wake[0], F_GETFL) | O_NONBLOCK);
+    fcntl(spectators->wake[1], F_SETFL, fcntl(spectators->wake[1], F_GETFL) | O_NONBLOCK);
+
+    bool unix_socket     = strchr(address, '/') != NULL;
+    int bound            = -1;
+    spectators->listener = socket(unix_socket ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (spectators->listener >= 0 && unix_socket) {
+        struct sockaddr_un local = { .sun_family = AF_UNIX };
+        snprintf(local.sun_path, sizeof(local.sun_path), "%s", address);
+        unlink(address);
+        bound = bind(spectators->listener, (struct sockaddr *)&local, sizeof(local));
+    } else if (spectators->listener >= 0) {
+        int yes = 1;
+        setsockopt(spectators->listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        struct sockaddr_in any = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY), .sin_port = htons((uint16_t)atoi(address)) };
+        bound                  = bind(spectators->listener, (struct sockaddr *)&any, sizeof(any));
+    }
+    if (bound < 0 || listen(spectators->listener, SPECTATOR_MAX_VIEWERS) < 0) {
+        fprintf(stderr, "ERROR: Could not listen for spectators on %s: %s\n", address, strerror(errno));
+        return false;
+    }
+    fcntl(spectators->listener, F_SETFL, fcntl(spectators->listener, F_GETFL) | O_NONBLOCK);
+
+    pthread_mutex_init(&spectators->mutex, NULL);
+    atomic_init(&spectators->number_of_viewers, 0);
+    atomic_init(&spectators->keyframe_wanted, true);
+    atomic_init(&spectators->running, true);
+    if (pthread_create(&spectators->thread, NULL, spectator_thread_main, spectators) != 0) {
+        fprintf(stderr, "ERROR: Could not create the spectator thread\n");
+        atomic_store(&spectators->running, false);
+        return false;
+    }
+    printf("INFO : Spectators can watch on %s\n", address);
+    return true;
+}
+
+void stop_spectators(Spectators *spectators)
+{
+    if (!atomic_load(&spectators->running))
+        return;
+    atomic_store(&spectators->running, false);
+    pthread_join(spectators->thread, NULL);
+    while (atomic_load(&spectators->number_of_viewers))
+        remove_viewer(spectators, 0);
+    for (size_t i = 0; i < spectators->number_of_pending; i++)
+        memory_free(spectators->pending[(spectators->first_pending + i) % SPECTATOR_PENDING]);
+    if (spectators->frames) {
+        printf("INFO : Spectators got %" PRIu64 " frames, %.2f us and %.0f bytes each, %" PRIu64 " key frames, %" PRIu64 " dropped\n",
+               spectators->frames, spectators->encode_time / 1e3 / spectators->frames, (double)spectators->bytes / spectators->frames,
+               spectators->keyframes, spectators->dropped);
+    }
+    close(spectators->listener);
+    close(spectators->wake[0]);
+    close(spectators->wake[1]);
+    pthread_mutex_destroy(&spectators->mutex);
+    memory_free(spectators->previous);
+    memory_free(spectators->encoded);
+}
+
+//==========Capture==========//
+// --capture <file> writes every presented frame to disk. A file ending in
+// .y4m becomes raw YUV 4:2:0 video that players and encoders read directly.
+// Any other file gets our own format: a PNG key frame every
+// CAPTURE_KEYFRAME_INTERVAL frames and XOR deltas to the frame before in
+// between, run length encoded like the rewind buffer. Every frame carries
+// the time it was presented at, Y4M only knows a fixed frame rate.
+// The render thread copies the framebuffer into a free buffer and hands it
+// to a writer thread through a single producer single consumer ring, the
+// buffer comes back through another one. Color conversion and I/O happen on
+// the writer thread. Without a free buffer the frame is dropped and counted,
+// the game never waits for the disk.
+//
+// Our format: a CaptureHeader, then for every frame a CaptureRecord and its
+// data, a PNG or a delta to the previous frame as flipped RGB bytes.
+#define CAPTURE_BUFFERS           8 // must be a power of two
+#define CAPTURE_KEYFRAME_INTERVAL 60
+#define CAPTURE_FRAME_PIXELS      (WINDOW_WIDTH * WINDOW_HEIGHT)
+#define CAPTURE_MAGIC             0x50414353 // "SCAP"
+
+typedef enum {
+    CAPTURE_PNG,
+    CAPTURE_DELTA,
+} CaptureRecordType;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t width, height;
+} CaptureHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size; // of the data after the record
+    uint64_t frame;
+    int64_t time; // ns since the capture started
+} CaptureRecord;
+
+typedef struct {
+    uint32_t *pixels;
+    uint64_t frame;
+    int64_t time;
+} CaptureBuffer;
+
+typedef struct {
+    CaptureBuffer *buffers[CAPTURE_BUFFERS];
+    atomic_size_t head; // next slot to write, only moved by the producer
+    atomic_size_t tail; // next slot to read, only moved by the consumer
+} CaptureRing;
+
+typedef struct {
+    FILE *file;
+    const char *path;
+    bool y4m;
+    CaptureBuffer buffers[CAPTURE_BUFFERS];
+    CaptureRing full; // render thread to writer
+    CaptureRing free; // writer to render thread
+    int64_t start;
+    // render thread
+    uint64_t frames, dropped;
+    int64_t handoff_time; // ns
+    // writer thread
+    uint8_t *rgb, *previous_rgb; // flipped RGB of the frame and the one before
+    uint8_t *yuv;
+    uint8_t *delta;
+    uint64_t written, bytes;
+    bool failed;
+    atomic_bool running;
+    pthread_t thread;
+} Capture;
+
+static Capture CAPTURE;
+
+static bool capture_ring_push(CaptureRing *ring, CaptureBuffer *buffer)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= CAPTURE_BUFFERS)
+        return false;
+    ring->buffers[head & (CAPTURE_BUFFERS - 1)] = buffer;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+static CaptureBuffer *capture_ring_pop(CaptureRing *ring)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head)
+        return NULL;
+    CaptureBuffer *buffer = ring->buffers[tail & (CAPTURE_BUFFERS - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return buffer;
+}
+
+// Called by the render thread with every frame it presents.
+void capture_frame(Capture *capture, const uint32_t *pixels)
+{
+    int64_t start          = now_ns();
+    CaptureBuffer *buffer  = capture_ring_pop(&capture->free);
+    if (buffer) {
+        memcpy(buffer->pixels, pixels, CAPTURE_FRAME_PIXELS * sizeof(uint32_t));
+        buffer->frame = capture->frames;
+        buffer->time  = start - capture->start;
+        capture_ring_push(&capture->full, buffer);
+    } else {
+        capture->dropped++;
+    }
+    capture->frames++;
+    capture->handoff_time += now_ns() - start;
+}
+
+// framebuffer colors are 0xRRGGBBAA and the first row is the bottom one
+static void capture_to_rgb(const uint32_t *pixels, uint8_t *rgb)
+{
+    for (size_t y = 0; y < WINDOW_HEIGHT; y++) {
+        const uint32_t *row = pixels + (WINDOW_HEIGHT - 1 - y) * WINDOW_WIDTH;
+        for (size_t x = 0; x < WINDOW_WIDTH; x++) {
+            *rgb++ = (uint8_t)(row[x] >> 24);
+            *rgb++ = (uint8_t)(row[x] >> 16);
+            *rgb++ = (uint8_t)(row[x] >> 8);
+        }
+    }
+}
+
+// full range BT.601 as JPEG does it, chroma is the average of 2x2 pixels
+static void rgb_to_yuv420(const uint8_t *rgb, uint8_t *yuv)
+{
+    uint8_t *u = yuv + CAPTURE_FRAME_PIXELS;
+    uint8_t *v = u + CAPTURE_FRAME_PIXELS / 4;
+    for (size_t i = 0; i < CAPTURE_FRAME_PIXELS; i++) {
+        const uint8_t *p = rgb + i * 3;
+        yuv[i]           = (uint8_t)((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+    }
+    for (size_t y = 0; y < WINDOW_HEIGHT; y += 2) {
+        for (size_t x = 0; x < WINDOW_WIDTH; x += 2) {
+            int r = 0, g = 0, b = 0;
+            for (size_t dy = 0; dy < 2; dy++) {
+                for (size_t dx = 0; dx < 2; dx++) {
+                    const uint8_t *p = rgb + ((y + dy) * WINDOW_WIDTH + x + dx) * 3;
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            *u++ = (uint8_t)((-43 * r - 85 * g + 128 * b + 512 * 128 + 512) >> 10);
+            *v++ = (uint8_t)((128 * r - 107 * g - 21 * b + 512 * 128 + 512) >> 10);
+        }
+    }
+}
+
+static void capture_write(Capture *capture, const void *data, size_t size)
+{
+    if (capture->failed)
+        return;
+    if (fwrite(data, 1, size, capture->file) != size) {
+        fprintf(stderr, "ERROR: Could not write to %s, the capture stops here: %s\n", capture->path, strerror(errno));
+        capture->failed = true;
+    }
+    capture->bytes += size;
+}
+
+static void capture_write_frame(Capture *capture, CaptureBuffer *buffer)
+{
+    if (capture->failed)
+        return;
+    capture_to_rgb(buffer->pixels, capture->rgb);
+    if (capture->y4m) {
+        rgb_to_yuv420(capture->rgb, capture->yuv);
+        capture_write(capture, "FRAME\n", 6);
+        capture_write(capture, capture->yuv, CAPTURE_FRAME_PIXELS * 3 / 2);
+    } else {
+        // deltas go to the last written frame, so dropped frames don't break the chain
+        CaptureRecord record = { .frame = buffer->frame, .time = buffer->time };
+        const void *data;
+        if (capture->written % CAPTURE_KEYFRAME_INTERVAL == 0) {
+            int length  = 0;
+            data        = stbi_write_png_to_mem(capture->rgb, WINDOW_WIDTH * 3, WINDOW_WIDTH, WINDOW_HEIGHT, 3, &length);
+            record.type = CAPTURE_PNG;
+            record.size = (uint32_t)length;
+        } else {
+            data        = capture->delta;
+            record.type = CAPTURE_DELTA;
+            record.size = (uint32_t)encode_delta(capture->previous_rgb, capture->rgb, CAPTURE_FRAME_PIXELS * 3, capture->delta);
+        }
+        if (!data) {
+            fprintf(stderr, "ERROR: Could not encode frame %" PRIu64 " of the capture\n", buffer->frame);
+            capture->failed = true;
+            return;
+        }
+        capture_write(capture, &record, sizeof(record));
+        capture_write(capture, data, record.size);
+        if (record.type == CAPTURE_PNG)
+            image_free((void *)data);
+        uint8_t *previous     = capture->previous_rgb;
+        capture->previous_rgb = capture->rgb;
+        capture->rgb          = previous;
+    }
+    capture->written++;
+}
+
+void *capture_thread_main(void *arg)
+{
+    Capture *capture = arg;
+    for (;;) {
+        CaptureBuffer *buffer = capture_ring_pop(&capture->full);
+        if (buffer) {
+            capture_write_frame(capture, buffer);
+            capture_ring_push(&capture->free, buffer);
+        } else if (!atomic_load(&capture->running)) {
+            break; // the render thread is gone, nothing more will come
+        } else {
+            struct timespec idle = { .tv_nsec = 1000000 };
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+bool start_capture(Capture *capture, const char *path, int frame_rate)
+{
+    const char *extension = strrchr(path, '.');
+    capture->path         = path;
+    capture->y4m          = extension && strcmp(extension, ".y4m") == 0;
+    capture->file         = fopen(path, "wb");
+    if (!capture->file) {
+        fprintf(stderr, "ERROR: Could not open %s to capture to: %s\n", path, strerror(errno));
+        return false;
+    }
+    capture->rgb          = memory_alloc(MEMORY_CAPTURE, CAPTURE_FRAME_PIXELS * 3);
+    capture->previous_rgb = memory_alloc(MEMORY_CAPTURE, CAPTURE_FRAME_PIXELS * 3);
+    capture->yuv          = memory_alloc(MEMORY_CAPTURE, CAPTURE_FRAME_PIXELS * 3 / 2);
+    capture->delta        = memory_alloc(MEMORY_CAPTURE, CAPTURE_FRAME_PIXELS * 3 * 2);
+    if (!capture->rgb || !capture->previous_rgb || !capture->yuv || !capture->delta) {
+        fprintf(stderr, "ERROR: Could not malloc memory for the capture. Please buy more RAM!\n");
+        return false;
+    }
+    for (size_t i = 0; i < CAPTURE_BUFFERS; i++) {
+        capture->buffers[i].pixels = memory_alloc(MEMORY_CAPTURE, CAPTURE_FRAME_PIXELS * sizeof(uint32_t));
+        if (!capture->buffers[i].pixels) {
+            fprintf(stderr, "ERROR: Could not malloc memory for the capture. Please buy more RAM!\n");
+            return false;
+        }
+        capture_ring_push(&capture->free, &capture->buffers[i]);
+    }
+
+    if (capture->y4m) {
+        fprintf(capture->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", WINDOW_WIDTH, WINDOW_HEIGHT, frame_rate);
+    } else {
+        CaptureHeader header = { .magic = CAPTURE_MAGIC, .width = WINDOW_WIDTH, .height = WINDOW_HEIGHT };
+        capture_write(capture, &header, sizeof(header));
+    }
+    capture->start = now_ns();
+    atomic_init(&capture->running, true);
+    if (pthread_create(&capture->thread, NULL, capture_thread_main, capture) != 0) {
+        fprintf(stderr, "ERROR: Could not create the capture thread\n");
+        atomic_store(&capture->running, false);
+        return false;
+    }
+    printf("INFO : Capturing to %s (%s)\n", path, capture->y4m ? "Y4M" : "PNG key frames and deltas");
+    return true;
+}
+
+// the render thread must be stopped, the writer finishes the frames it has
+void stop_capture(Capture *capture)
+{
+    if (!atomic_load(&capture->running))
+        return;
+    atomic_store(&capture->running, false);
+    pthread_join(capture->thread, NULL);
+    if (fclose(capture->file) != 0 && !capture->failed)
+        fprintf(stderr, "ERROR: Could not write to %s: %s\n", capture->path, strerror(errno));
+    if (capture->frames) {
+        printf("INFO : Captured %" PRIu64 " frames to %s, %.1f MB, %" PRIu64 " dropped, %.2f us per frame to hand off\n", capture->written,
+               capture->path, capture->bytes / 1e6, capture->dropped, capture->handoff_time / 1e3 / capture->frames);
+    }
+    for (size_t i = 0; i < CAPTURE_BUFFERS; i++)
+        memory_free(capture->buffers[i].pixels);
+    memory_free(capture->rgb);
+    memory_free(capture->previous_rgb);
+    memory_free(capture->yuv);
+    memory_free(capture->delta);
+}
+
+//==========Renderer==========//
+// The render thread owns the GL context. It rasterizes the newest snapshot,
+// uploads it and swaps, so a slow glfwSwapBuffers never holds back input
+// polling or the simulation.
+#define RASTER_BAND_HEIGHT    32
+#define PIXEL_VERTEX_SHADER   "pixel_vertex.glsl"
+#define PIXEL_FRAGMENT_SHADER "pixel_fragment.glsl"
+
+typedef struct {
+    GLFWwindow *window;
+    SnapshotMailbox mailbox;
+    Snapshot *snapshot; // the one being rasterized
+    uint32_t *pixels;
+    atomic_bool failed;
+    atomic_bool resized;
+    atomic_int framebuffer_width, framebuffer_height;
+    pthread_t thread;
+    // latency measurement
+    LatencyHistogram latency;
+    int64_t last_measured_input;
+    atomic_uint_fast64_t presented_ticks;
+    // late latching, the simulation keeps the newest player position here
+    _Atomic Fixed player_x;
+    atomic_llong player_time;
+    _Atomic double time_scale; // 0 while paused
+} Renderer;
+
+static Renderer RENDERER;
+
+// draws the rows from begin to end of the snapshot, on top of what is there
+void draw_snapshot(Renderer *renderer, size_t begin, size_t end)
+{
+    Snapshot *snapshot = renderer->snapshot;
+    // when late latching the player is drawn just before the upload
+    for (size_t i = CONFIG.late_latch ? 1 : 0; i < snapshot->number_of_items; i++) {
+        DrawItem *item = &snapshot->items[i];
+        draw_sprite_clipped(renderer->pixels, SPRITES[item->sprite], item->x, item->y, item->color, begin, end);
+    }
+}
+
+void rasterize_job(void *data, size_t begin, size_t end)
+{
+    Renderer *renderer = data;
+    pixels_clear(&renderer->pixels[begin * WINDOW_WIDTH], (end - begin) * WINDOW_WIDTH, 0x181818FF);
+    draw_snapshot(renderer, begin, end);
+}
+
+// rasterizes the snapshot into renderer->pixels with the raster jobs and waits for them
+void rasterize_snapshot(Renderer *renderer, Snapshot *snapshot)
+{
+    renderer->snapshot = snapshot;
+    Job *raster        = job_create(rasterize_job, renderer, 0, WINDOW_HEIGHT, RASTER_BAND_HEIGHT);
+    if (raster)
+        job_submit(raster);
+    job_wait_all();
+}
+
+// Moves the player to where it is now instead of where it was when the
+// snapshot was taken: the newest position from the simulation plus what the
+// held keys did since, using the same per tick speed. The simulation stays
+// authoritative and the next snapshot corrects any difference.
+// Returns the time of the key event the position is based on.
+int64_t late_latch_player(Renderer *renderer, Snapshot *snapshot)
+{
+    DrawItem player = snapshot->items[0];
+    int64_t now     = now_ns();
+    double ticks    = (now - atomic_load(&renderer->player_time)) * (SIMULATION_RATE / 1e9) * atomic_load(&renderer->time_scale);
+    int direction   = atomic_load(&KEY_DOWN[INPUT_RIGHT]) - atomic_load(&KEY_DOWN[INPUT_LEFT]);
+    player.x        = atomic_load(&renderer->player_x) + (Fixed)(direction * PLAYER_SPEED * ticks);
+    if (player.x < 0)
+        player.x = 0;
+    if (player.x >= int_to_fixed(WINDOW_WIDTH))
+        player.x = int_to_fixed(WINDOW_WIDTH - 1);
+    draw_sprite_clipped(renderer->pixels, SPRITES[player.sprite], player.x, player.y, player.color, 0, WINDOW_HEIGHT);
+    return atomic_load(&LAST_KEY_EVENT_TIME);
+}
+
+void use_pixel_shader(GLuint shader)
+{
+    glUseProgram(shader);
+    GLuint location = glGetUniformLocation(shader, "pixels");
+    glUniform1i(location, 0);
+}
+
+// runs between two frames, when no raster job is reading sprites
+void apply_hot_reload(GLuint *shader)
+{
+    unsigned int changes = atomic_exchange(&HOT_RELOAD.pending, 0);
+    if (changes & HOT_RELOAD_SHADERS) {
+        GLuint program = load_shader(PIXEL_VERTEX_SHADER, PIXEL_FRAGMENT_SHADER);
+        if (program) {
+            glDeleteProgram(*shader);
+            *shader = program;
+            use_pixel_shader(program);
+        } else {
+            fprintf(stderr, "ERROR: Keeping the previous shader program\n");
+        }
+    }
+    if (changes & HOT_RELOAD_SPRITES)
+        reload_sprite_sheet(SPRITE_SHEET);
+}
 
+void *render_thread_main(void *arg)
+{
+    Renderer *renderer = arg;
+    glfwMakeContextCurrent(renderer->window);
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         fprintf(stderr, "ERROR: Failed to initialize GLAD\n");
-        return -1;
+        atomic_store(&renderer->failed, true);
+        return NULL;
+    }
+    if (!job_register_thread()) {
+        atomic_store(&renderer->failed, true);
+        return NULL;
     }
 
     glClearColor(1, 0, 0, 1);
 
-    uint32_t *pixels = malloc(sizeof(uint32_t) * WINDOW_HEIGHT * WINDOW_WIDTH);
-    pixels_clear(pixels, WINDOW_HEIGHT * WINDOW_WIDTH, 0);
+    renderer->pixels = memory_alloc(MEMORY_FRAMEBUFFER, sizeof(uint32_t) * WINDOW_HEIGHT * WINDOW_WIDTH);
+    if (!renderer->pixels) {
+        fprintf(stderr, "ERROR: Could not malloc memory for pixels. Please buy more RAM!\n");
+        atomic_store(&renderer->failed, true);
+        return NULL;
+    }
+    pixels_clear(renderer->pixels, WINDOW_HEIGHT * WINDOW_WIDTH, 0);
 
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, pixels);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, WINDOW_WIDTH, WINDOW_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, renderer->pixels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -560,88 +5633,791 @@ int main()
     GLuint vao;
     glGenVertexArrays(1, &vao);
 
-    uint32_t shader = compile_shader("resources/pixel_vertex.glsl", "resources/pixel_fragment.glsl");
-    glUseProgram(shader);
-
-    GLuint location = glGetUniformLocation(shader, "pixels");
-    glUniform1i(location, 0);
+    GLuint shader = load_shader(PIXEL_VERTEX_SHADER, PIXEL_FRAGMENT_SHADER);
+    if (!shader) {
+        atomic_store(&renderer->failed, true);
+        return NULL;
+    }
+    use_pixel_shader(shader);
 
     glDisable(GL_DEPTH_TEST);
     glActiveTexture(GL_TEXTURE0);
 
     glBindVertexArray(vao);
 
-    init_player_object();
+    glfwSwapInterval(CONFIG.pacing == PACING_VSYNC ? 1 : 0);
+    FramePacer pacer;
+    double budget_fps = CONFIG.pacing == PACING_CAPPED ? CONFIG.fps_cap : CONFIG.pacing == PACING_VSYNC ? CONFIG.refresh_rate : 0;
+    init_frame_pacer(&pacer, CONFIG.pacing, budget_fps, CONFIG.frame_stats);
 
-    Object **green_enemies = create_green_enemies();
-    Object **red_enemies   = create_red_enemies();
+    for (;;) {
+        // wait before taking the snapshot so that we draw the newest one
+        pacer_wait(&pacer);
+        Snapshot *snapshot = mailbox_wait(&renderer->mailbox);
+        if (!snapshot)
+            break;
 
-    initialize_fires();
+        apply_hot_reload(&shader);
+        if (atomic_exchange(&renderer->resized, false))
+            glViewport(0, 0, atomic_load(&renderer->framebuffer_width), atomic_load(&renderer->framebuffer_height));
 
-    glfwSetFramebufferSizeCallback(window, frame_buffer_callback);
+        rasterize_snapshot(renderer, snapshot);
 
-    while (!glfwWindowShouldClose(window)) {
-        pixels_clear(pixels, WINDOW_HEIGHT * WINDOW_WIDTH, 0x181818FF);
-
-        check_player_action(window, &PLAYER_OBJECT, pixels);
-        draw_object(pixels, &PLAYER_OBJECT);
-
-        moving_fires();
-        for (size_t i = 0; i < MAX_PLAYER_FIRES; i++)
-            if (player_fires[i] != NULL)
-                draw_object(pixels, player_fires[i]);
-        for (size_t i = 0; i < MAX_ENEMY_FIRES; i++)
-            if (enemy_fires[i] != NULL)
-                draw_object(pixels, enemy_fires[i]);
-
-        double curr_time = glfwGetTime();
-        for (size_t i = 0; i < NUMBER_OF_GREEN_ENEMIES_IN_ROW; i++) {
-            if (green_enemies[i] != NULL) {
-                play_object_animation(green_enemies[i], green_enemies[i]->animations[0]);
-                moving_enemy_animation(green_enemies[i], curr_time);
-                if (check_collision(green_enemies[i], player_fires, MAX_PLAYER_FIRES)) {
-                    delete_object(green_enemies[i]);
-                    green_enemies[i] = NULL;
-                    continue;
-                }
-                draw_object(pixels, green_enemies[i]);
-            }
-        }
-        for (size_t i = 0; i < NUMBER_OF_RED_ENEMIES_IN_ROW; i++) {
-            if (red_enemies[i] != NULL) {
-                play_object_animation(red_enemies[i], red_enemies[i]->animations[0]);
-                moving_enemy_animation(red_enemies[i], curr_time);
-                if (check_collision(red_enemies[i], player_fires, MAX_PLAYER_FIRES)) {
-                    delete_object(red_enemies[i]);
-                    red_enemies[i] = NULL;
-                    continue;
-                }
-                draw_object(pixels, red_enemies[i]);
-            }
+        int64_t input_time = snapshot->input_time;
+        if (CONFIG.late_latch) {
+            int64_t latched_input_time = late_latch_player(renderer, snapshot);
+            if (input_time <= renderer->last_measured_input)
+                input_time = latched_input_time;
         }
-        check_to_spawn_enemy_fires(red_enemies, NUMBER_OF_RED_ENEMIES_IN_ROW);
-        check_to_spawn_enemy_fires(green_enemies, NUMBER_OF_GREEN_ENEMIES_IN_ROW);
+        if (CONFIG.spectate)
+            spectator_frame(&SPECTATORS, renderer->pixels);
+        if (CONFIG.capture)
+            capture_frame(&CAPTURE, renderer->pixels);
 
         glTexSubImage2D(
             GL_TEXTURE_2D,
             0, 0, 0,
             WINDOW_WIDTH, WINDOW_HEIGHT,
             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8,
-            pixels);
+            renderer->pixels);
 
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-        glfwSwapBuffers(window);
+        glfwSwapBuffers(renderer->window);
+        pacer_frame_done(&pacer);
+        if (pacer.total.frames == 1)
+            printf("INFO : First frame presented %.3f ms after start\n", ms_since_startup());
+
+        // an input stays pending until a presented snapshot carries it, so
+        // only count the first frame for each one
+        if (input_time > renderer->last_measured_input) {
+            record_latency(&renderer->latency, now_ns() - input_time);
+            renderer->last_measured_input = input_time;
+        }
+        atomic_store(&renderer->presented_ticks, snapshot->tick + 1);
+    }
+    print_frame_stats("Frame pacing in total", &pacer.total);
+    print_latency(&renderer->latency);
+
+    glDeleteVertexArrays(1, &vao);
+    glDeleteTextures(1, &texture);
+    glDeleteProgram(shader);
+    memory_free(renderer->pixels);
+    glfwMakeContextCurrent(NULL);
+    return NULL;
+}
+
+// the window's context must not be current on the calling thread
+bool start_renderer(Renderer *renderer, GLFWwindow *window)
+{
+    renderer->window = window;
+    atomic_init(&renderer->failed, false);
+    atomic_init(&renderer->resized, false);
+    atomic_init(&renderer->presented_ticks, 0);
+    atomic_init(&renderer->player_x, PLAYERS[0].x);
+    atomic_init(&renderer->player_time, now_ns());
+    init_mailbox(&renderer->mailbox);
+    if (pthread_create(&renderer->thread, NULL, render_thread_main, renderer) != 0) {
+        fprintf(stderr, "ERROR: Could not create render thread\n");
+        return false;
+    }
+    printf("INFO : Render thread has been started!\n");
+    return true;
+}
+
+void stop_renderer(Renderer *renderer)
+{
+    mailbox_close(&renderer->mailbox);
+    pthread_join(renderer->thread, NULL);
+    destroy_mailbox(&renderer->mailbox);
+}
+
+void frame_buffer_callback(GLFWwindow *window, int width, int height)
+{
+    atomic_store(&RENDERER.framebuffer_width, width);
+    atomic_store(&RENDERER.framebuffer_height, height);
+    atomic_store(&RENDERER.resized, true);
+}
+
+//==========Replay==========//
+// --replay <file> plays an input recording from --record-input without a
+// window. Every recorded event is fed through the input ring at its tick, and
+// every tick is simulated. Time controls in the recording are ignored. Game
+// time only moves by whole steps, so a replay gives the same frames on every
+// machine and every run.
+// With --golden <dir> the framebuffer is rasterized at the ticks listed in
+// <dir>/golden.txt and its hash is compared with the one listed there. When a
+// frame differs, its PNG and a diff against <dir>/<tick>.png are written
+// next to them. --update-golden writes a new golden.txt and reference PNGs,
+// checking every GOLDEN_INTERVAL ticks up to a second past the last event.
+// Any change to the rasterizer has to give the same frames, or show where it
+// does not.
+#define GOLDEN_INTERVAL   1000
+#define GOLDEN_MAX_FRAMES 4096
+
+typedef struct {
+    uint64_t tick;
+    InputEvent event; // time relative to the start of the tick
+} ReplayEvent;
+
+typedef struct {
+    ReplayEvent *events;
+    size_t number_of_events;
+    size_t next;
+    uint64_t last_tick;
+    InputState input;
+} Replay;
+
+typedef struct {
+    uint64_t tick;
+    uint64_t hash;
+} GoldenFrame;
+
+static Replay REPLAY;
+
+bool load_replay(Replay *replay, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open %s to replay: %s\n", path, strerror(errno));
+        return false;
+    }
+    *replay         = (Replay){ 0 };
+    size_t capacity = 0;
+    uint64_t tick;
+    int action, pressed;
+    int64_t offset;
+    while (fscanf(file, "%" SCNu64 " %d %d %" SCNd64, &tick, &action, &pressed, &offset) == 4) {
+        if (action < 0 || action >= NUMBER_OF_INPUT_ACTIONS || tick < replay->last_tick) {
+            fprintf(stderr, "ERROR: %s is not an input recording\n", path);
+            break;
+        }
+        if (replay->number_of_events == capacity) {
+            capacity            = capacity ? capacity * 2 : 256;
+            ReplayEvent *events = memory_realloc(MEMORY_ASSETS, replay->events, capacity * sizeof(ReplayEvent));
+            if (!events) {
+                fprintf(stderr, "ERROR: Could not malloc memory for the replay. Please buy more RAM!\n");
+                break;
+            }
+            replay->events = events;
+        }
+        replay->events[replay->number_of_events++] = (ReplayEvent){ tick, { .time = offset, .action = (uint8_t)action, .pressed = pressed } };
+        replay->last_tick                          = tick;
+    }
+    bool complete = feof(file);
+    fclose(file);
+    if (!complete) {
+        memory_free(replay->events);
+        return false;
+    }
+    printf("INFO : Replaying %zu input events over %" PRIu64 " ticks from %s\n", replay->number_of_events, replay->last_tick, path);
+    return true;
+}
+
+void free_replay(Replay *replay)
+{
+    memory_free(replay->events);
+    *replay = (Replay){ 0 };
+}
+
+// the buttons of the player at tick, tick_time is the game time of the tick
+uint8_t replay_buttons(Replay *replay, uint64_t tick, int64_t tick_time)
+{
+    while (replay->next < replay->number_of_events && replay->events[replay->next].tick <= tick) {
+        InputEvent event = replay->events[replay->next].event;
+        event.time += tick_time;
+        if (!input_ring_push(&INPUT_RING, event))
+            break; // the rest of the tick comes with the next one
+        replay->next++;
+    }
+    consume_input(&INPUT_RING, &replay->input, tick, tick_time, NULL);
+    return player_buttons(&replay->input, INPUT_LEFT, INPUT_RIGHT, INPUT_FIRE);
+}
+
+static size_t load_golden_frames(const char *path, GoldenFrame *frames)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    size_t count = 0;
+    while (count < GOLDEN_MAX_FRAMES && fscanf(file, "%" SCNu64 " %" SCNx64, &frames[count].tick, &frames[count].hash) == 2)
+        count++;
+    fclose(file);
+    if (count == 0)
+        fprintf(stderr, "ERROR: There are no frames in %s\n", path);
+    return count;
+}
+
+// writes the frame and, if there is a reference, a diff with the changed
+// pixels in magenta over a dimmed reference, returns the changed pixels
+static size_t write_golden_diff(const char *dir, uint64_t tick, const uint32_t *pixels)
+{
+    char path[512];
+    uint8_t *rgb = memory_alloc(MEMORY_FRAMEBUFFER, CAPTURE_FRAME_PIXELS * 3);
+    if (!rgb) {
+        fprintf(stderr, "ERROR: Could not malloc memory for a diff. Please buy more RAM!\n");
+        return 0;
+    }
+    capture_to_rgb(pixels, rgb);
+    snprintf(path, sizeof(path), "%s/%" PRIu64 ".actual.png", dir, tick);
+    stbi_write_png(path, WINDOW_WIDTH, WINDOW_HEIGHT, 3, rgb, WINDOW_WIDTH * 3);
+
+    size_t changed = 0;
+    int width, height, channels;
+    snprintf(path, sizeof(path), "%s/%" PRIu64 ".png", dir, tick);
+    uint8_t *golden = stbi_load(path, &width, &height, &channels, 3);
+    if (golden && width == WINDOW_WIDTH && height == WINDOW_HEIGHT) {
+        for (size_t i = 0; i < CAPTURE_FRAME_PIXELS * 3; i += 3) {
+            if (memcmp(&golden[i], &rgb[i], 3) != 0) {
+                golden[i]     = 0xFF;
+                golden[i + 1] = 0;
+                golden[i + 2] = 0xFF;
+                changed++;
+            } else {
+                golden[i] /= 4;
+                golden[i + 1] /= 4;
+                golden[i + 2] /= 4;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%" PRIu64 ".diff.png", dir, tick);
+        stbi_write_png(path, WINDOW_WIDTH, WINDOW_HEIGHT, 3, golden, WINDOW_WIDTH * 3);
+    } else {
+        fprintf(stderr, "ERROR: There is no reference image %s to diff against\n", path);
+    }
+    stbi_image_free(golden);
+    memory_free(rgb);
+    return changed;
+}
+
+static void write_golden_frame(const char *dir, uint64_t tick, const uint32_t *pixels)
+{
+    char path[512];
+    uint8_t *rgb = memory_alloc(MEMORY_FRAMEBUFFER, CAPTURE_FRAME_PIXELS * 3);
+    if (!rgb) {
+        fprintf(stderr, "ERROR: Could not malloc memory for a golden frame. Please buy more RAM!\n");
+        return;
+    }
+    capture_to_rgb(pixels, rgb);
+    snprintf(path, sizeof(path), "%s/%" PRIu64 ".png", dir, tick);
+    if (!stbi_write_png(path, WINDOW_WIDTH, WINDOW_HEIGHT, 3, rgb, WINDOW_WIDTH * 3))
+        fprintf(stderr, "ERROR: Could not write %s\n", path);
+    memory_free(rgb);
+}
+
+// returns false if a frame differs from its golden hash
+bool run_replay(Replay *replay, Frame *frame)
+{
+    static GoldenFrame golden[GOLDEN_MAX_FRAMES];
+    size_t number_of_golden = 0;
+    char path[512];
+    FILE *update = NULL;
+    if (CONFIG.golden) {
+        snprintf(path, sizeof(path), "%s/golden.txt", CONFIG.golden);
+        if (CONFIG.update_golden) {
+            if (mkdir(CONFIG.golden, 0755) != 0 && errno != EEXIST)
+                fprintf(stderr, "ERROR: Could not create %s: %s\n", CONFIG.golden, strerror(errno));
+            update = fopen(path, "w");
+            if (!update) {
+                fprintf(stderr, "ERROR: Could not open %s to write: %s\n", path, strerror(errno));
+                return false;
+            }
+            for (uint64_t tick = GOLDEN_INTERVAL; number_of_golden < GOLDEN_MAX_FRAMES; tick += GOLDEN_INTERVAL) {
+                golden[number_of_golden++].tick = tick;
+                if (tick > replay->last_tick)
+                    break;
+            }
+        } else if ((number_of_golden = load_golden_frames(path, golden)) == 0) {
+            return false;
+        }
+    }
+
+    RENDERER.pixels = memory_alloc(MEMORY_FRAMEBUFFER, sizeof(uint32_t) * WINDOW_HEIGHT * WINDOW_WIDTH);
+    if (!RENDERER.pixels) {
+        fprintf(stderr, "ERROR: Could not malloc memory for pixels. Please buy more RAM!\n");
+        return false;
+    }
+    CONFIG.late_latch = false;
+    static Snapshot snapshot;
+    uint64_t last_tick = number_of_golden ? golden[number_of_golden - 1].tick : replay->last_tick;
+    size_t next_golden = 0, failed = 0;
+    uint64_t hash      = 0;
+    int64_t start      = now_ns();
+    for (; frame->tick <= last_tick; frame->tick++) {
+        arena_reset(&FRAME_ARENA);
+        frame_clock_tick(&CLOCK);
+        uint8_t buttons = replay_buttons(replay, frame->tick, CLOCK.game_time);
+        simulate_tick(frame, &buttons);
+
+        bool checked = next_golden < number_of_golden && golden[next_golden].tick == frame->tick;
+        if (!checked && frame->tick != last_tick)
+            continue;
+        take_snapshot(&snapshot, frame);
+        rasterize_snapshot(&RENDERER, &snapshot);
+        hash = hash_bytes(RENDERER.pixels, sizeof(uint32_t) * WINDOW_HEIGHT * WINDOW_WIDTH, HASH_SEED);
+        if (!checked)
+            continue;
+        if (update) {
+            fprintf(update, "%" PRIu64 " %016" PRIx64 "\n", frame->tick, hash);
+            write_golden_frame(CONFIG.golden, frame->tick, RENDERER.pixels);
+        } else if (hash != golden[next_golden].hash) {
+            size_t changed = write_golden_diff(CONFIG.golden, frame->tick, RENDERER.pixels);
+            fprintf(stderr, "ERROR: The frame at tick %" PRIu64 " is not the golden one, %zu pixels changed, see %s/%" PRIu64 ".diff.png\n",
+                    frame->tick, changed, CONFIG.golden, frame->tick);
+            failed++;
+        }
+        next_golden++;
+    }
+    printf("INFO : Replayed %" PRIu64 " ticks in %.1f ms, the last frame hashes to %016" PRIx64 "\n", frame->tick, (now_ns() - start) / 1e6, hash);
+    if (update) {
+        fclose(update);
+        printf("INFO : Wrote %zu golden frames to %s\n", number_of_golden, CONFIG.golden);
+    } else if (number_of_golden) {
+        printf("INFO : %zu of %zu frames match the golden ones in %s\n", number_of_golden - failed, number_of_golden, CONFIG.golden);
+    }
+    memory_free(RENDERER.pixels);
+    RENDERER.pixels = NULL;
+    return failed == 0;
+}
+
+//==========Perf Check==========//
+// --perf-check <baseline> replays every --replay session --perf-runs times
+// without a window. It times the stages of a frame and compares them with the
+// baseline. A stage that got slower than --perf-tolerance percent makes the
+// run exit nonzero. --update-baseline writes the baseline instead.
+// Everything runs on one thread with --jobs 1, so a stage's time is its own
+// and not whatever the scheduler overlapped with it. The simulation runs every
+// tick and a frame is drawn every PERF_FRAME_INTERVAL ticks, as for a 60 Hz
+// display. There is no GPU on a build box, so the upload is timed with
+// software_upload(), which converts the pixels the way the driver has to.
+// A single tick is too short to time on its own, so the simulation is timed
+// for every frame, over the PERF_FRAME_INTERVAL ticks from it to the next.
+// Only the collisions are timed tick by tick, they happen in the middle of a
+// tick. Other
+// work on the machine only ever makes a frame slower, and a frame is shorter
+// than the time slice the scheduler gives to it, so the fastest time of every
+// frame over the runs counts and the stage is the sum of them. Every session
+// gets a warm-up run that is not counted.
+// Update and collision are in us per tick, the other stages in us per frame.
+// Sessions are known by their file name, so the baseline works from any
+// directory. It only holds for the machine that wrote it.
+#define PERF_FRAME_INTERVAL 16
+#define PERF_SLACK          0.1 // us, below this no stage counts as slower
+
+typedef enum {
+    PERF_CLEAR,
+    PERF_UPDATE,
+    PERF_COLLISION,
+    PERF_DRAW,
+    PERF_UPLOAD,
+    NUMBER_OF_PERF_STAGES,
+} PerfStage;
+
+static const char *PERF_STAGE_NAMES[NUMBER_OF_PERF_STAGES] = { "clear", "update", "collision", "draw", "upload" };
+
+typedef struct {
+    char session[512];
+    char stage[32];
+    double us;
+} PerfBaseline;
+
+// glTexSubImage2D of GL_UNSIGNED_INT_8_8_8_8 pixels into our GL_RGB8 texture
+static void software_upload(const uint32_t *pixels, uint8_t *texture)
+{
+    for (size_t i = 0; i < CAPTURE_FRAME_PIXELS; i++) {
+        uint32_t pixel = pixels[i];
+        *texture++     = (uint8_t)(pixel >> 24);
+        *texture++     = (uint8_t)(pixel >> 16);
+        *texture++     = (uint8_t)(pixel >> 8);
+    }
+}
+
+static void perf_keep_fastest(int64_t *fastest, int64_t time)
+{
+    if (time < *fastest)
+        *fastest = time;
+}
+
+// One run of the session from the start, keeps the fastest time in ns of
+// every frame and stage. The simulation keeps a snapshot of every frame,
+// taking it counts as update, and the frames are cleared, drawn and uploaded
+// after it. Every frame is drawn over the one before, which is the same work.
+static void perf_run(Replay *replay, Frame *frame, Snapshot *snapshots, uint8_t *texture, int64_t (*fastest)[NUMBER_OF_PERF_STAGES])
+{
+    size_t frames     = 0;
+    int64_t collision = 0;
+    int64_t start     = now_ns();
+    for (frame->tick = 0; frame->tick <= replay->last_tick; frame->tick++) {
+        arena_reset(&FRAME_ARENA);
+        frame_clock_tick(&CLOCK);
+        uint8_t buttons = replay_buttons(replay, frame->tick, CLOCK.game_time);
+        begin_tick(frame, &buttons);
+        run_movement_jobs(frame);
+        int64_t collision_start = now_ns();
+        run_collision_jobs(frame);
+        collision += now_ns() - collision_start;
+        dispatch_events(&EVENTS);
+        if (frame->tick % PERF_FRAME_INTERVAL == 0)
+            take_snapshot(&snapshots[frames++], frame);
+        if ((frame->tick + 1) % PERF_FRAME_INTERVAL != 0 && frame->tick != replay->last_tick)
+            continue;
+
+        int64_t end = now_ns();
+        perf_keep_fastest(&fastest[frames - 1][PERF_COLLISION], collision);
+        perf_keep_fastest(&fastest[frames - 1][PERF_UPDATE], end - start - collision);
+        collision = 0;
+        start     = now_ns();
+    }
+
+    for (size_t i = 0; i < frames; i++) {
+        start = now_ns();
+        pixels_clear(RENDERER.pixels, WINDOW_WIDTH * WINDOW_HEIGHT, 0x181818FF);
+        int64_t end = now_ns();
+        perf_keep_fastest(&fastest[i][PERF_CLEAR], end - start);
+        start             = end;
+        RENDERER.snapshot = &snapshots[i];
+        draw_snapshot(&RENDERER, 0, WINDOW_HEIGHT);
+        end = now_ns();
+        perf_keep_fastest(&fastest[i][PERF_DRAW], end - start);
+        start = end;
+        software_upload(RENDERER.pixels, texture);
+        perf_keep_fastest(&fastest[i][PERF_UPLOAD], now_ns() - start);
+    }
+}
+
+static size_t load_perf_baseline(const char *path, PerfBaseline *baseline, size_t capacity)
+{
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: Could not open the baseline %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    size_t count = 0;
+    while (count < capacity && fscanf(file, "%511s %31s %lf", baseline[count].session, baseline[count].stage, &baseline[count].us) == 3)
+        count++;
+    fclose(file);
+    return count;
+}
+
+// returns false if a stage got slower than the baseline allows
+bool run_perf_check(Frame *frame, Rules *rules)
+{
+    static PerfBaseline baseline[MAX_REPLAYS * NUMBER_OF_PERF_STAGES];
+    static uint8_t initial_state[MAX_GAME_STATE_SIZE];
+    size_t number_of_baselines = 0;
+    FILE *update               = NULL;
+    if (CONFIG.update_baseline) {
+        update = fopen(CONFIG.perf_check, "w");
+        if (!update) {
+            fprintf(stderr, "ERROR: Could not open %s to write: %s\n", CONFIG.perf_check, strerror(errno));
+            return false;
+        }
+    } else if ((number_of_baselines = load_perf_baseline(CONFIG.perf_check, baseline, MAX_REPLAYS * NUMBER_OF_PERF_STAGES)) == 0) {
+        return false;
+    }
+
+    size_t state_size = save_game_state(initial_state, sizeof(initial_state), rules);
+    RENDERER.pixels   = memory_alloc(MEMORY_FRAMEBUFFER, sizeof(uint32_t) * WINDOW_HEIGHT * WINDOW_WIDTH);
+    uint8_t *texture  = memory_alloc(MEMORY_FRAMEBUFFER, CAPTURE_FRAME_PIXELS * 3);
+    if (!state_size || !RENDERER.pixels || !texture) {
+        fprintf(stderr, "ERROR: Could not malloc memory for the perf check. Please buy more RAM!\n");
+        memory_free(RENDERER.pixels);
+        memory_free(texture);
+        return false;
+    }
+    CONFIG.late_latch = false;
+    size_t runs       = CONFIG.perf_runs < 1 ? 1 : CONFIG.perf_runs;
+    size_t regressed  = 0;
+    for (size_t session = 0; session < CONFIG.number_of_replays; session++) {
+        const char *path  = CONFIG.replays[session];
+        const char *slash = strrchr(path, '/');
+        const char *name  = slash ? slash + 1 : path;
+        Replay replay;
+        if (!load_replay(&replay, path)) {
+            regressed++;
+            continue;
+        }
+        uint64_t frames                         = replay.last_tick / PERF_FRAME_INTERVAL + 1;
+        Snapshot *snapshots                     = memory_alloc(MEMORY_FRAMEBUFFER, frames * sizeof(Snapshot));
+        int64_t (*fastest)[NUMBER_OF_PERF_STAGES] = memory_alloc(MEMORY_FRAMEBUFFER, frames * sizeof(*fastest));
+        if (!snapshots || !fastest) {
+            fprintf(stderr, "ERROR: Could not malloc memory for the snapshots of %s. Please buy more RAM!\n", name);
+            memory_free(snapshots);
+            memory_free(fastest);
+            free_replay(&replay);
+            regressed++;
+            continue;
+        }
+        // run 0 is the warm-up, its times are thrown away before run 1
+        for (size_t run = 0; run <= runs; run++) {
+            if (run <= 1) {
+                for (size_t i = 0; i < frames; i++) {
+                    for (size_t stage = 0; stage < NUMBER_OF_PERF_STAGES; stage++)
+                        fastest[i][stage] = INT64_MAX;
+                }
+            }
+            load_game_state(initial_state, state_size, rules);
+            replay.next  = 0;
+            replay.input = (InputState){ 0 };
+            perf_run(&replay, frame, snapshots, texture, fastest);
+        }
+
+        for (size_t stage = 0; stage < NUMBER_OF_PERF_STAGES; stage++) {
+            int64_t total = 0;
+            for (size_t i = 0; i < frames; i++)
+                total += fastest[i][stage];
+            bool per_tick = stage == PERF_UPDATE || stage == PERF_COLLISION;
+            double us     = total / 1e3 / (per_tick ? replay.last_tick + 1 : frames);
+            if (update) {
+                fprintf(update, "%s %s %.3f\n", name, PERF_STAGE_NAMES[stage], us);
+                printf("INFO : %s %-9s %8.3f us\n", name, PERF_STAGE_NAMES[stage], us);
+                continue;
+            }
+            PerfBaseline *base = NULL;
+            for (size_t i = 0; i < number_of_baselines && !base; i++) {
+                if (strcmp(baseline[i].session, name) == 0 && strcmp(baseline[i].stage, PERF_STAGE_NAMES[stage]) == 0)
+                    base = &baseline[i];
+            }
+            if (!base) {
+                printf("INFO : %s %-9s %8.3f us, not in the baseline\n", name, PERF_STAGE_NAMES[stage], us);
+            } else if (us > base->us * (1 + CONFIG.perf_tolerance / 100) + PERF_SLACK) {
+                fprintf(stderr, "ERROR: %s %-9s %8.3f us, %+.1f%% to the baseline of %.3f us is too slow\n", name, PERF_STAGE_NAMES[stage], us,
+                        (us / base->us - 1) * 100, base->us);
+                regressed++;
+            } else {
+                printf("INFO : %s %-9s %8.3f us, %+.1f%% to the baseline\n", name, PERF_STAGE_NAMES[stage], us, (us / base->us - 1) * 100);
+            }
+        }
+        memory_free(fastest);
+        memory_free(snapshots);
+        free_replay(&replay);
+    }
+    if (update) {
+        fclose(update);
+        printf("INFO : Wrote the baseline of %zu sessions to %s\n", CONFIG.number_of_replays, CONFIG.perf_check);
+    } else {
+        printf("INFO : Perf check of %zu sessions with %zu runs each: %s\n", CONFIG.number_of_replays, runs, regressed ? "slower" : "passed");
+    }
+    memory_free(texture);
+    memory_free(RENDERER.pixels);
+    RENDERER.pixels = NULL;
+    return regressed == 0;
+}
+
+//==========Main==========//
+
+// Runs the game with input and a window until the window is closed.
+bool run_window(GLFWwindow *window, Frame *frame, Rules *rules)
+{
+    glfwSetFramebufferSizeCallback(window, frame_buffer_callback);
+    glfwSetKeyCallback(window, key_callback);
+
+    InputState input   = { 0 };
+    FILE *input_record = NULL;
+    if (CONFIG.record_input) {
+        input_record = fopen(CONFIG.record_input, "w");
+        if (!input_record)
+            fprintf(stderr, "ERROR: Could not open %s to record input\n", CONFIG.record_input);
+    }
+
+    const GLFWvidmode *mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+    CONFIG.refresh_rate     = mode ? mode->refreshRate : 60;
+
+    if (CONFIG.spectate && !start_spectators(&SPECTATORS, CONFIG.spectate))
+        return false;
+    int capture_rate = CONFIG.pacing == PACING_CAPPED ? (int)CONFIG.fps_cap : (int)CONFIG.refresh_rate;
+    if (CONFIG.capture && !start_capture(&CAPTURE, CONFIG.capture, capture_rate))
+        return false;
+    if (!start_renderer(&RENDERER, window))
+        return false;
+
+    int64_t next_tick = CLOCK.real_time;
+    while (!glfwWindowShouldClose(window) && !atomic_load(&RENDERER.failed)) {
+        arena_reset(&FRAME_ARENA);
         glfwPollEvents();
+        frame_clock_tick(&CLOCK);
+        int64_t tick_time = CLOCK.real_time;
+
+        int64_t first_event_time = consume_input(&INPUT_RING, &input, frame->tick, tick_time, input_record);
+        track_pending_input(frame, first_event_time, atomic_load(&RENDERER.presented_ticks));
+        uint8_t buttons = player_buttons(&input, INPUT_LEFT, INPUT_RIGHT, INPUT_FIRE);
+        if (CONFIG.connect_address) {
+            if (buttons != NET_CLIENT.buttons) {
+                NET_CLIENT.buttons = buttons;
+                net_client_send(&NET_CLIENT);
+            }
+            net_client_receive(&NET_CLIENT);
+        } else if (CONFIG.netplay) {
+            if (CONFIG.netplay == NETPLAY_LOOPBACK)
+                loopback_peer_update(&LOOPBACK_PEER, NETPLAY.tick, player_buttons(&input, INPUT_LEFT_2, INPUT_RIGHT_2, INPUT_FIRE_2));
+            netplay_update(&NETPLAY, frame, rules, buttons);
+        } else {
+            check_time_controls(&input, &CLOCK);
+            if (!CLOCK.paused && input.down[INPUT_REWIND]) {
+                rewind_step(&REWIND, rules);
+            } else if (!CLOCK.paused) {
+                simulate_tick(frame, &buttons);
+                rewind_record(&REWIND, rules);
+            }
+        }
+        if (CONFIG.late_latch) {
+            atomic_store(&RENDERER.player_x, PLAYERS[frame->local_player].x);
+            atomic_store(&RENDERER.player_time, tick_time);
+            atomic_store(&RENDERER.time_scale, CLOCK.paused ? 0 : CLOCK.scale);
+        }
+
+        if (CONFIG.connect_address)
+            take_net_snapshot(mailbox_write_slot(&RENDERER.mailbox), &NET_CLIENT, frame);
+        else
+            take_snapshot(mailbox_write_slot(&RENDERER.mailbox), frame);
+        mailbox_publish(&RENDERER.mailbox);
+        frame->tick++;
+
+        next_tick += frame_clock_interval(&CLOCK);
+        int64_t now = now_ns();
+        if (now - next_tick > PACING_MAX_LAG)
+            next_tick = now;
+        precise_wait_until(next_tick);
     }
 
+    stop_renderer(&RENDERER);
+    stop_spectators(&SPECTATORS);
+    stop_capture(&CAPTURE);
+    if (CONFIG.connect_address)
+        close_net_client(&NET_CLIENT);
+    if (input_record)
+        fclose(input_record);
+    if (atomic_load(&INPUT_RING.dropped))
+        fprintf(stderr, "ERROR: %zu input events were dropped\n", atomic_load(&INPUT_RING.dropped));
+
     glfwDestroyWindow(window);
     glfwTerminate();
+    return true;
+}
 
-    glDeleteVertexArrays(1, &vao);
+int main(int argc, char **argv)
+{
+    STARTUP_TIME = now_ns();
+    if (!parse_arguments(argc, argv))
+        return -1;
+    if (CONFIG.track_memory)
+        start_memory_tracking();
+    if (CONFIG.bots) {
+        if (!CONFIG.connect_address) {
+            fprintf(stderr, "ERROR: --bots needs a server to --connect to\n");
+            return -1;
+        }
+        return run_bots(CONFIG.connect_address, CONFIG.bots) ? 0 : -1;
+    }
+    init_cache_dir(CONFIG.cache_dir);
+    if (!init_resources(CONFIG.resource_dir, CONFIG.asset_pack, CONFIG.verify_assets))
+        return -1;
+    if (!load_sprite_sheet(SPRITE_SHEET))
+        return -1;
+    if (CONFIG.hot_reload)
+        start_hot_reload(&HOT_RELOAD);
+
+    if (CONFIG.perf_check) {
+        if (!CONFIG.number_of_replays) {
+            fprintf(stderr, "ERROR: --perf-check needs a session to --replay\n");
+            return -1;
+        }
+        // the stages are timed on one thread, see Perf Check
+        CONFIG.job_threads = 1;
+    } else if (CONFIG.number_of_replays > 1) {
+        fprintf(stderr, "ERROR: Only --perf-check plays more than one replay\n");
+        return -1;
+    } else if (CONFIG.number_of_replays && !load_replay(&REPLAY, CONFIG.replays[0])) {
+        return -1;
+    }
+
+    GLFWwindow *window = NULL;
+    if (!CONFIG.server_port && !CONFIG.number_of_replays) {
+        init_glfw();
+        window = create_window();
+        if (!window)
+            return -1;
+        printf("INFO : Window ready %.3f ms after start\n", ms_since_startup());
+        // the render thread owns the context from now on
+        glfwMakeContextCurrent(NULL);
+    }
+
+    if (!init_job_system(CONFIG.job_threads))
+        return -1;
+    if (!init_arena(&FRAME_ARENA, "frame", FRAME_ARENA_SIZE))
+        return -1;
+
+    init_timer_wheel(&TIMERS);
+    init_sin_table();
+    init_entity_table(&ENTITIES);
+    if (!init_arena(&WAVE_ARENA, "wave", WAVE_ARENA_SIZE))
+        return -1;
+    init_player_objects(CONFIG.netplay || CONFIG.server_port ? MAX_PLAYERS : 1);
+
+    EntityHandle *green_enemies = create_green_enemies();
+    EntityHandle *red_enemies   = create_red_enemies();
+
+    initialize_fires();
+    EnemyRow rows[] = {
+        { red_enemies, NUMBER_OF_RED_ENEMIES_IN_ROW, spawn_red_enemies },
+        { green_enemies, NUMBER_OF_GREEN_ENEMIES_IN_ROW, spawn_green_enemies },
+    };
+    for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++)
+        start_enemy_fire(&rows[i]);
+    Rules rules;
+    init_rules(&rules, rows, sizeof(rows) / sizeof(rows[0]));
+    // the other peer can not go back in time with us
+    if (CONFIG.netplay) {
+        if (!start_netplay(&NETPLAY, CONFIG.netplay, CONFIG.net_address, CONFIG.net_latency, CONFIG.net_loss))
+            return -1;
+    } else if (CONFIG.server_port) {
+        if (!start_server(&SERVER, CONFIG.server_port))
+            return -1;
+    } else if (CONFIG.connect_address) {
+        // a thin client only draws what the server sends
+        if (!connect_net_client(&NET_CLIENT, CONFIG.connect_address))
+            return -1;
+        CONFIG.late_latch = false;
+    } else if (!CONFIG.number_of_replays && CONFIG.rewind_budget && !start_rewind(&REWIND, CONFIG.rewind_budget, &rules)) {
+        return -1;
+    }
+
+    Frame frame = {
+        .local_player  = NETPLAY.local,
+        .green_enemies = green_enemies,
+        .red_enemies   = red_enemies,
+    };
+    init_frame_clock(&CLOCK, 1000000000 / SIMULATION_RATE, CONFIG.time_scale);
+    bool passed = true;
+    if (CONFIG.server_port)
+        run_server(&SERVER, &frame, &rules);
+    else if (CONFIG.perf_check)
+        passed = run_perf_check(&frame, &rules);
+    else if (CONFIG.number_of_replays)
+        passed = run_replay(&REPLAY, &frame);
+    else if (!run_window(window, &frame, &rules))
+        return -1;
+
+    stop_hot_reload(&HOT_RELOAD);
+    shutdown_job_system();
+
+    printf("INFO : Score %" PRIu64 " in wave %u\n", rules.score, rules.wave);
+    print_event_counts(&EVENTS);
+    stop_rewind(&REWIND);
+    stop_netplay(&NETPLAY);
+    stop_server(&SERVER);
+    free_replay(&REPLAY);
+    print_arena_peak(&FRAME_ARENA);
+    free_arena(&FRAME_ARENA);
 
-    free(pixels);
     delete_enemies(green_enemies, NUMBER_OF_GREEN_ENEMIES_IN_ROW);
+    delete_enemies(red_enemies, NUMBER_OF_RED_ENEMIES_IN_ROW);
+    print_arena_peak(&WAVE_ARENA);
+    free_arena(&WAVE_ARENA);
+    close_asset_pack(&ASSET_PACK);
+    free_sprite_sheet();
+    print_memory_report();
 
-    return 0;
-}
\ No newline at end of file
+    return passed ? 0 : -1;
+}
@@ -0,0 +1,162 @@
+// Builds an asset pack (see asset_pack.h) from every file under a directory.
+//   asset_packer <resource dir> <output pack>
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../asset_pack.h"
+
+#define MAX_ASSETS 1024
+
+typedef struct {
+    char name[ASSET_NAME_LENGTH];
+    char path[2048];
+} Asset;
+
+static Asset assets[MAX_ASSETS];
+static size_t number_of_assets = 0;
+
+uint64_t hash_bytes(const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash        = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool collect_assets(const char *root, const char *relative)
+{
+    char dir_path[1024];
+    snprintf(dir_path, sizeof(dir_path), "%s%s%s", root, relative[0] ? "/" : "", relative);
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        fprintf(stderr, "ERROR: Could not open directory %s\n", dir_path);
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        char name[1024], path[2048];
+        snprintf(name, sizeof(name), "%s%s%s", relative, relative[0] ? "/" : "", entry->d_name);
+        snprintf(path, sizeof(path), "%s/%s", root, name);
+        struct stat info;
+        if (stat(path, &info) != 0)
+            continue;
+        if (S_ISDIR(info.st_mode)) {
+            if (!collect_assets(root, name)) {
+                closedir(dir);
+                return false;
+            }
+            continue;
+        }
+        if (strlen(name) >= ASSET_NAME_LENGTH) {
+            fprintf(stderr, "ERROR: Asset name %s is longer than %d characters\n", name, ASSET_NAME_LENGTH - 1);
+            closedir(dir);
+            return false;
+        }
+        if (number_of_assets >= MAX_ASSETS) {
+            fprintf(stderr, "ERROR: Too many assets, at most %d are supported\n", MAX_ASSETS);
+            closedir(dir);
+            return false;
+        }
+        Asset *asset = &assets[number_of_assets++];
+        memset(asset->name, 0, sizeof(asset->name));
+        strcpy(asset->name, name);
+        snprintf(asset->path, sizeof(asset->path), "%s", path);
+    }
+    closedir(dir);
+    return true;
+}
+
+int compare_assets(const void *a, const void *b)
+{
+    return strcmp(((const Asset *)a)->name, ((const Asset *)b)->name);
+}
+
+static uint64_t align(uint64_t offset)
+{
+    return (offset + ASSET_PACK_ALIGNMENT - 1) & ~(uint64_t)(ASSET_PACK_ALIGNMENT - 1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <resource dir> <output pack>\n", argv[0]);
+        return 1;
+    }
+    if (!collect_assets(argv[1], ""))
+        return 1;
+    qsort(assets, number_of_assets, sizeof(Asset), compare_assets);
+
+    AssetPackEntry *entries = calloc(number_of_assets ? number_of_assets : 1, sizeof(AssetPackEntry));
+    uint8_t **data          = calloc(number_of_assets ? number_of_assets : 1, sizeof(uint8_t *));
+    if (!entries || !data) {
+        fprintf(stderr, "ERROR: Could not malloc memory for the pack. Please buy more RAM!\n");
+        return 1;
+    }
+    uint64_t offset = align(sizeof(AssetPackHeader) + number_of_assets * sizeof(AssetPackEntry));
+    for (size_t i = 0; i < number_of_assets; i++) {
+        FILE *file = fopen(assets[i].path, "rb");
+        if (!file) {
+            fprintf(stderr, "ERROR: Could not open file %s\n", assets[i].path);
+            return 1;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data[i] = malloc(size + 1);
+        if (!data[i] || fread(data[i], 1, size, file) != (size_t)size) {
+            fprintf(stderr, "ERROR: Could not read file %s\n", assets[i].path);
+            return 1;
+        }
+        fclose(file);
+
+        memcpy(entries[i].name, assets[i].name, ASSET_NAME_LENGTH);
+        entries[i].offset = offset;
+        entries[i].size   = size;
+        entries[i].hash   = hash_bytes(data[i], size);
+        offset            = align(offset + size + 1);
+    }
+
+    AssetPackHeader header = {
+        .magic             = ASSET_PACK_MAGIC,
+        .version           = ASSET_PACK_VERSION,
+        .number_of_entries = (uint32_t)number_of_assets,
+        .size              = offset,
+    };
+    FILE *out = fopen(argv[2], "wb");
+    if (!out) {
+        fprintf(stderr, "ERROR: Could not create %s\n", argv[2]);
+        return 1;
+    }
+    static const uint8_t zeros[ASSET_PACK_ALIGNMENT + 1] = { 0 };
+    bool ok        = fwrite(&header, sizeof(header), 1, out) == 1;
+    ok             = ok && fwrite(entries, sizeof(AssetPackEntry), number_of_assets, out) == number_of_assets;
+    uint64_t wrote = sizeof(header) + number_of_assets * sizeof(AssetPackEntry);
+    for (size_t i = 0; ok && i < number_of_assets; i++) {
+        ok    = ok && fwrite(zeros, 1, entries[i].offset - wrote, out) == entries[i].offset - wrote;
+        ok    = ok && fwrite(data[i], 1, entries[i].size, out) == entries[i].size;
+        wrote = entries[i].offset + entries[i].size;
+    }
+    ok = ok && fwrite(zeros, 1, offset - wrote, out) == offset - wrote;
+    ok = (fclose(out) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "ERROR: Could not write %s\n", argv[2]);
+        remove(argv[2]);
+        return 1;
+    }
+    printf("INFO : Packed %zu assets into %s (%llu bytes)\n", number_of_assets, argv[2], (unsigned long long)offset);
+
+    for (size_t i = 0; i < number_of_assets; i++)
+        free(data[i]);
+    free(data);
+    free(entries);
+    return 0;
+}